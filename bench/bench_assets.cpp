@@ -0,0 +1,109 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Compares the ways the index data is loaded at startup: the original
+// ifstream >> double parser building the face to all map, the current
+// text fallback and mapping the binary asset.
+//
+// usage: bench_assets [-d data dir] [-n iterations]
+//   the asset should be made beforehand with facefit_assets
+
+#include "bench_util.h"
+#include "../src/faceassets.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+
+
+static const int kResolution = 256;
+
+
+// what StaticData did before the asset
+static void readIndicesStream(const std::string& path,
+				std::vector<int>& indices)
+{
+	std::fstream ifs;
+	ifs.open(path);
+	double index;
+	while (ifs >> index)
+		indices.push_back((int)index);
+}
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = "data";
+	int iterations = 20;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-d" && i + 1 < argc)
+			dataPath = argv[++i];
+		else if (arg == "-n" && i + 1 < argc)
+			iterations = std::max(1, std::atoi(argv[++i]));
+	}
+
+	std::string dir = dataPath + "/uv-data/";
+	std::string assetPath = dir + kStaticAssetName;
+
+	BenchReport report("assets");
+	BenchReport::printHeader();
+
+	report.add(measure("ifstream", iterations, [&] {
+		std::vector<int> face, kpt, tris;
+		std::map<int, int> face2all;
+		readIndicesStream(dir + "face_ind.txt", face);
+		for (size_t i = 0; i < face.size(); i++)
+			face2all[i] = face[i];
+		readIndicesStream(dir + "uv_kpt_ind.txt", kpt);
+		readIndicesStream(dir + "triangles.txt", tris);
+		Point3List points(kResolution * kResolution);
+		Point3List uvs(kResolution * kResolution);
+		for (int i = 0; i < kResolution; i++) {
+			for (int j = 0; j < kResolution; j++) {
+				int k = i * kResolution + j;
+				points[k].set(i * 2, j * 2, 0);
+				uvs[k].set((float)j / kResolution,
+					1 - (float)i / kResolution, 0);
+			}
+		}
+	}));
+
+	report.add(measure("text fallback", iterations, [&] {
+		FaceAssets assets;
+		assets.loadText(dir + "triangles.txt", dir + "face_ind.txt",
+				dir + "uv_kpt_ind.txt", kResolution);
+	}));
+
+	FaceAssets probe;
+	if (!probe.map(assetPath, kResolution)) {
+		std::cout << "No asset at " << assetPath
+				<< ", run facefit_assets first\n";
+		return 1;
+	}
+	// the first touch of each page, as a process starting would do
+	report.add(measure("mapped asset", iterations, [&] {
+		FaceAssets assets;
+		assets.map(assetPath, kResolution);
+		volatile int sum = 0;
+		for (int i : assets.faceIndices())
+			sum += i;
+		for (const Point3& p : assets.uvs())
+			sum += (int)p.x;
+	}));
+	return 0;
+}
@@ -0,0 +1,189 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Measures the detectors at several minimal face sizes on CPU: the median
+// time of a detection, which includes the conversion of the frame, and
+// the recall. The faces of an image are read from <image>.boxes next to
+// it, a face per line as "left top right bottom" in top-down pixels.
+// Without them the reference is what the CNN detector finds in the
+// frame upsampled for 20 pixels faces, the most thorough configuration.
+//
+// usage: bench_detector [-d data dir] [-n iterations] image...
+
+#include "../src/imageio.h"
+#include "../src/nuke2tf.h"
+
+#include <dlib/image_processing/box_overlap_testing.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+using namespace dlib;
+
+
+static const int kResolution = 256;
+// a detection matches a reference face overlapping it this much
+static const double kMinOverlap = 0.5;
+static const int kReferenceFaceSize = 20;
+static const int kFaceSizes[] = { 0, 40, 80, 160 };
+
+typedef std::chrono::steady_clock Clock;
+
+
+struct Image
+{
+	std::string path;
+	LinearImage image;
+	std::vector<rectangle> faces;
+};
+
+
+static bool readBoxes(const std::string& path, std::vector<rectangle>& boxes)
+{
+	std::ifstream f(path);
+	if (!f)
+		return false;
+	long l, t, r, b;
+	while (f >> l >> t >> r >> b)
+		boxes.push_back(rectangle(l, t, r, b));
+	return true;
+}
+
+
+// Reference faces found by the detections, each one at most once
+static size_t matches(const std::vector<rectangle>& reference,
+				const std::vector<rectangle>& dets)
+{
+	std::vector<bool> found(reference.size(), false);
+	size_t n = 0;
+	for (auto& det : dets) {
+		for (size_t i = 0; i < reference.size(); i++) {
+			if (!found[i] && box_intersection_over_union(
+					det, reference[i]) >= kMinOverlap) {
+				found[i] = true;
+				n++;
+				break;
+			}
+		}
+	}
+	return n;
+}
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = "data";
+	int iterations = 5;
+	std::vector<Image> images;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-d" && i + 1 < argc) {
+			dataPath = argv[++i];
+		} else if (arg == "-n" && i + 1 < argc) {
+			iterations = std::max(1, std::atoi(argv[++i]));
+		} else {
+			Image image;
+			image.path = arg;
+			if (loadLinearImage(arg, image.image))
+				images.push_back(image);
+			else
+				std::cout << "Couldn't read " << arg << "\n";
+		}
+	}
+	if (images.empty()) {
+		std::cout << "usage: bench_detector [-d data dir] "
+			"[-n iterations] image...\n";
+		return 1;
+	}
+
+	CnnFaceDetector cnn(dataPath +
+			"/net-data/mmod_human_face_detector.dat");
+	Nuke2TensorFlow n2tf(kResolution);
+
+	bool annotated = false;
+	size_t numFaces = 0;
+	for (auto& image : images) {
+		if (readBoxes(image.path + ".boxes", image.faces)) {
+			annotated = true;
+		} else {
+			DetectorConfig reference;
+			reference.type = kCnnDetector;
+			reference.minFaceSize = kReferenceFaceSize;
+			n2tf.setDetector(reference, &cnn);
+			n2tf.detect(image.image.view(), image.faces);
+		}
+		numFaces += image.faces.size();
+	}
+	if (!cnn.loaded())
+		std::cout << "No CNN model, its rows are of HOG\n";
+	std::printf("%zu images, %zu faces %s\n", images.size(), numFaces,
+			annotated ? "annotated" : "the CNN finds at 20 px");
+	std::printf("%-5s %9s %7s %8s %10s %8s %8s\n", "det", "min face",
+		"scale", "ms", "detections", "recall", "false");
+
+	for (DetectorType type : { kHogDetector, kCnnDetector }) {
+		for (int faceSize : kFaceSizes) {
+			DetectorConfig config;
+			config.type = type;
+			config.minFaceSize = faceSize;
+			n2tf.setDetector(config, &cnn);
+
+			double ms = 0;
+			size_t numDets = 0, numFound = 0;
+			std::vector<rectangle> dets;
+			for (auto& image : images) {
+				ImageView view = image.image.view();
+				std::vector<double> times;
+				for (int i = 0; i < iterations; i++) {
+					auto start = Clock::now();
+					if (!n2tf.detect(view, dets))
+						dets.clear();
+					times.push_back(std::chrono::duration<
+						double, std::milli>(
+						Clock::now() - start).count());
+				}
+				std::sort(times.begin(), times.end());
+				ms += times[times.size() / 2];
+				numDets += dets.size();
+				numFound += matches(image.faces, dets);
+			}
+
+			// of the first image, the plates are usually alike
+			int factor;
+			unsigned upsample;
+			Nuke2TensorFlow::detectionScale(config,
+				images[0].image.height, factor, upsample);
+			char scale[16];
+			if (upsample > 0)
+				std::snprintf(scale, sizeof(scale), "x%d",
+							1 << upsample);
+			else
+				std::snprintf(scale, sizeof(scale), "1/%d",
+								factor);
+			std::printf("%-5s %9s %7s %8.1f %10zu %7.1f%% %8zu\n",
+				detectorName(type), faceSize ?
+				std::to_string(faceSize).c_str() : "auto",
+				scale, ms / images.size(), numDets,
+				numFaces ? 100.0 * numFound / numFaces : 0.0,
+				numDets - numFound);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,138 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Compares fitting every face of a frame in a single batch, like the
+// plug-in's "all faces" mode, with a node per face, each converting and
+// detecting on the whole frame and fitting its face alone. Prints the
+// median time per frame for 1, 2, ... faces, up to the faces found in
+// the image, e.g. a crowd shot.
+//
+// usage: bench_faces [-d data dir] [-n iterations] image
+
+#include "../src/imageio.h"
+#include "../src/nuke2tf.h"
+#include "../src/prnet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+using namespace dlib;
+
+
+static const int kResolution = 256;
+// more than a frame usually has
+static const size_t kMaxFaces = 64;
+
+typedef std::chrono::steady_clock Clock;
+
+
+template <typename F>
+static double medianMs(int iterations, F f)
+{
+	std::vector<double> times;
+	for (int i = 0; i < iterations; i++) {
+		auto start = Clock::now();
+		f();
+		times.push_back(std::chrono::duration<double, std::milli>(
+					Clock::now() - start).count());
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = "data";
+	int iterations = 10;
+	std::string path;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-d" && i + 1 < argc)
+			dataPath = argv[++i];
+		else if (arg == "-n" && i + 1 < argc)
+			iterations = std::max(1, std::atoi(argv[++i]));
+		else
+			path = arg;
+	}
+	LinearImage image;
+	if (path.empty() || !loadLinearImage(path, image)) {
+		std::cout << "usage: bench_faces [-d data dir] "
+			"[-n iterations] image\n";
+		return 1;
+	}
+	ImageView view = image.view();
+
+	std::string model = dataPath + "/net-data/256_256_resfcn256_weight";
+	Nuke2TensorFlow::StaticData data(
+		dataPath + "/net-data/mmod_human_face_detector.dat",
+		dataPath + "/uv-data/triangles.txt",
+		dataPath + "/uv-data/face_ind.txt",
+		dataPath + "/uv-data/uv_kpt_ind.txt",
+		kResolution,
+		dataPath + "/uv-data/" + kStaticAssetName);
+	const PointLayout& face = data.faceLayout();
+	Nuke2TensorFlow n2tf(kResolution);
+
+	FloatTensor all = n2tf.facesPlane2Tensor(view, kMaxFaces);
+	if (all.dims() != 4) {
+		std::cout << "No faces in " << path << "\n";
+		return 1;
+	}
+	size_t numFaces = all.dimSize(0);
+	// a batch of all of them in one run, so the runs are the same
+	PRNet net(ModelConfig(model), numFaces);
+	// warm-up, the first runs allocate and autotune
+	net.infer(all);
+	net.infer(all.slice(0, 1));
+
+	Point3List points(face.size(kResolution));
+	std::printf("%zu faces in %dx%d, ms per frame\n", numFaces,
+						image.width, image.height);
+	std::printf("%6s %10s %10s %10s\n", "faces", "batched", "per node",
+							"vs 1 face");
+	double single = 0;
+	for (size_t n = 1; n <= numFaces; n++) {
+		double batched = medianMs(iterations, [&] {
+			FloatTensor input = n2tf.facesPlane2Tensor(view, n);
+			FloatTensor output = net.infer(input);
+			for (size_t i = 0; i < n; i++) {
+				n2tf.extractDataFromTensor(output,
+					n2tf.batchCrops()[i], face,
+					points.data(), i);
+			}
+		});
+		// each node finds the same face, the work is the same
+		double perNode = medianMs(iterations, [&] {
+			for (size_t i = 0; i < n; i++) {
+				FloatTensor input = n2tf.imagePlane2Tensor(
+						view, rectangle(), true);
+				FloatTensor output = net.infer(input);
+				n2tf.extractDataFromTensor(output, n2tf.crop(),
+						face, points.data());
+			}
+		});
+		if (n == 1)
+			single = batched;
+		std::printf("%6zu %10.2f %10.2f %9.2fx\n", n, batched,
+						perNode, batched / single);
+	}
+	return 0;
+}
@@ -0,0 +1,114 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Fits the same take with facefit_farm's shards on 1, 2, 4... workers and
+// prints the time, the frames per second and the speed-up over a single
+// worker, each worker on its share of the cores. The parts are merged and
+// removed after each run, the merge is timed apart.
+//
+// usage: bench_farm [-x facefit_batch] [-w max workers] [-d data dir]
+//                   [-m variant] [-e backend] [-o dir] image...
+//   the workers go up to the number of cores by default
+
+#include "../src/sequencefile.h"
+#include "../src/shards.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double> d =
+		std::chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+
+int main(int argc, char** argv)
+{
+	FarmConfig config;
+	std::string outDir = "/tmp";
+	int maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::string> images;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-x" && i + 1 < argc)
+			config.batchPath = argv[++i];
+		else if (arg == "-w" && i + 1 < argc)
+			maxWorkers = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "-o" && i + 1 < argc)
+			outDir = argv[++i];
+		else if ((arg == "-d" || arg == "-m" || arg == "-e") &&
+							i + 1 < argc) {
+			config.batchArgs.push_back(arg);
+			config.batchArgs.push_back(argv[++i]);
+		} else
+			images.push_back(arg);
+	}
+	if (images.empty()) {
+		std::cout << "No images\n";
+		return 1;
+	}
+	// a failed shard would skew the timing
+	config.retries = 0;
+
+	std::vector<int> counts;
+	for (int workers = 1; workers < maxWorkers; workers *= 2)
+		counts.push_back(workers);
+	counts.push_back(maxWorkers);
+
+	std::printf("%zu frames, %u cores\n", images.size(),
+				std::thread::hardware_concurrency());
+	std::printf("%8s %8s %10s %10s %10s %10s\n", "workers", "threads",
+		"seconds", "fps", "speed-up", "merge s");
+	double single = 0;
+	bool ok = true;
+	for (int workers : counts) {
+		config.workers = workers;
+		std::string output = outDir + "/bench_farm_" +
+					std::to_string(workers) + ".ffsq";
+		std::vector<Shard> shards = planShards(output, images.size(),
+								0, workers);
+		removeShards(shards);
+
+		auto start = std::chrono::steady_clock::now();
+		if (!runShards(config, images, shards)) {
+			ok = false;
+			break;
+		}
+		double fitSeconds = seconds(start);
+		start = std::chrono::steady_clock::now();
+		ok = mergeShards(shards, output) && ok;
+		double mergeSeconds = seconds(start);
+		removeShards(shards);
+		std::remove(output.c_str());
+
+		if (workers == 1)
+			single = fitSeconds;
+		int threads = std::max(1, (int)std::thread::hardware_concurrency()
+							/ workers);
+		std::printf("%8d %8d %10.2f %10.2f %10.2f %10.3f\n", workers,
+			threads, fitSeconds, images.size() / fitSeconds,
+			single / fitSeconds, mergeSeconds);
+	}
+	return ok ? 0 : 1;
+}
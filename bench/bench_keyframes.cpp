@@ -0,0 +1,209 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Measures the keyframe mode on a reference sequence, the images given in
+// order: fits every frame, then only keyframes interpolating the rest.
+// Prints the throughput of both and how far the interpolated key points
+// are from the ones fitted on each frame. Decoding isn't timed.
+//
+// usage: bench_keyframes [-d data dir] [-n interval] [-m max motion] image...
+
+#include "../src/imageio.h"
+#include "../src/keyframes.h"
+#include "../src/nuke2tf.h"
+#include "../src/prnet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+using namespace dlib;
+
+
+static const int kResolution = 256;
+
+typedef std::chrono::steady_clock Clock;
+
+
+static double since(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+class SequenceFitter {
+public:
+	// only the texels of the indices are extracted
+	SequenceFitter(const std::vector<std::string>& paths, PRNet& net,
+						IndexView indices) :
+		_paths(paths),
+		_net(net),
+		_indices(indices),
+		_n2tf(kResolution)
+	{
+	}
+
+	bool fit(int frame, Point3List& points)
+	{
+		if (frame < 0 || frame >= (int)_paths.size())
+			return false;
+		auto start = Clock::now();
+		LinearImage image;
+		bool loaded = loadLinearImage(_paths[frame], image);
+		_loadSeconds += since(start);
+		if (!loaded)
+			return false;
+
+		_inferences++;
+		auto input = _n2tf.imagePlane2Tensor(image.view(),
+						rectangle(), true);
+		if (input.dims() != 4)
+			return false;
+		auto output = _net.infer(input);
+		if (output.dims() != 4)
+			return false;
+		_n2tf.extractDataFromTensor(output, _indices);
+		points = _n2tf.points();
+		return true;
+	}
+
+	void reset()
+	{
+		_loadSeconds = 0;
+		_inferences = 0;
+	}
+
+	double loadSeconds() const { return _loadSeconds; }
+	int inferences() const { return _inferences; }
+
+private:
+	const std::vector<std::string>& _paths;
+	PRNet& _net;
+	IndexView _indices;
+	Nuke2TensorFlow _n2tf;
+	double _loadSeconds = 0;
+	int _inferences = 0;
+};
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = "data";
+	int interval = 8;
+	float maxMotion = 0.05f;
+	std::vector<std::string> paths;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-d" && i + 1 < argc)
+			dataPath = argv[++i];
+		else if (arg == "-n" && i + 1 < argc)
+			interval = std::max(2, std::atoi(argv[++i]));
+		else if (arg == "-m" && i + 1 < argc)
+			maxMotion = std::atof(argv[++i]);
+		else
+			paths.push_back(arg);
+	}
+	if (paths.size() < 2) {
+		std::cout << "usage: bench_keyframes [-d data dir] "
+			"[-n interval] [-m max motion] image...\n";
+		return 1;
+	}
+
+	std::string model = dataPath + "/net-data/256_256_resfcn256_weight";
+	Nuke2TensorFlow::StaticData data(
+		dataPath + "/net-data/mmod_human_face_detector.dat",
+		dataPath + "/uv-data/triangles.txt",
+		dataPath + "/uv-data/face_ind.txt",
+		dataPath + "/uv-data/uv_kpt_ind.txt",
+		kResolution,
+		dataPath + "/uv-data/" + kStaticAssetName);
+	// the key points alone, like the plug-in's key points mode
+	const PointLayout& layout = data.kptLayout();
+	IndexView kpt = layout.kptIndices;
+	PRNet net{ModelConfig(model)};
+	SequenceFitter fitter(paths, net, layout.indices);
+	int numFrames = paths.size();
+
+	// the reference, only the key points are kept
+	std::vector<Point3List> reference(numFrames);
+	std::vector<bool> fitted(numFrames, false);
+	auto start = Clock::now();
+	Point3List points;
+	for (int f = 0; f < numFrames; f++) {
+		if (!fitter.fit(f, points))
+			continue;
+		fitted[f] = true;
+		for (int i : kpt)
+			reference[f].push_back(points[i]);
+	}
+	double fullSeconds = since(start) - fitter.loadSeconds();
+	fitter.reset();
+
+	// keyframes are kept until the sequence has passed them
+	std::map<int, Point3List> keyframes;
+	auto inferKeyframe = [&](int f, Point3List& points) {
+		auto it = keyframes.find(f);
+		if (it != keyframes.end()) {
+			points = it->second;
+			return true;
+		}
+		if (!fitter.fit(f, points))
+			return false;
+		keyframes[f] = points;
+		return true;
+	};
+
+	double sumError = 0, maxError = 0;
+	int numCompared = 0;
+	start = Clock::now();
+	for (int f = 0; f < numFrames; f++) {
+		keyframes.erase(keyframes.begin(),
+				keyframes.lower_bound(f - interval));
+		// the last frames have no keyframe after them
+		if (!interpolateFrame(f, interval, maxMotion, kpt,
+					inferKeyframe, points) &&
+				!inferKeyframe(f, points))
+			continue;
+		if (!fitted[f])
+			continue;
+		for (size_t k = 0; k < kpt.size(); k++) {
+			const Point3& p = points[kpt[k]];
+			const Point3& q = reference[f][k];
+			double error = std::hypot(p.x - q.x, p.y - q.y);
+			sumError += error;
+			maxError = std::max(maxError, error);
+			numCompared++;
+		}
+	}
+	double keySeconds = since(start) - fitter.loadSeconds();
+
+	std::printf("%d frames, keyframes every %d, max motion %.3f\n",
+				numFrames, interval, maxMotion);
+	std::printf("every frame: %7.2f fps\n", numFrames / fullSeconds);
+	std::printf("keyframes:   %7.2f fps, %d inferences, %.2fx\n",
+			numFrames / keySeconds, fitter.inferences(),
+			fullSeconds / keySeconds);
+	if (numCompared > 0) {
+		std::printf("key point error: mean %.2f px, max %.2f px\n",
+				sumError / numCompared, maxError);
+	}
+	return 0;
+}
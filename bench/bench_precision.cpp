@@ -0,0 +1,237 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Compares the reduced precision models quantize_graph.py makes with the
+// float one: the error of the face's vertices in pixels of the crop, the
+// single frame latency, the batched throughput, the load time and how
+// much the process grows by loading a model.
+//
+// usage: bench_precision [-d data dir] [-b batch size] [-e backend]
+//                        crop.ppm...
+//   the crops are the network's inputs facefit_batch -c writes, without
+//   them it runs on noise, which is fine for the speed only
+
+#include "../src/faceassets.h"
+#include "../src/imageio.h"
+#include "../src/prnet.h"
+#include "../src/trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+
+
+static const int kResolution = 256;
+static const int kRandomCrops = 32;
+// the position map is scaled by this into pixels of the crop
+static const float kPositionScale = kResolution * 1.1f;
+
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double> d =
+		std::chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+
+static bool loadCrop(const std::string& path, FloatTensor& crop)
+{
+	dlib::matrix<dlib::rgb_pixel> img;
+	if (!loadImage(path, img) || img.nr() != kResolution ||
+					img.nc() != kResolution)
+		return false;
+	crop = FloatTensor(1, kResolution, kResolution, 3);
+	float* dst = crop.data();
+	for (int i = 0; i < kResolution; i++) {
+		for (int j = 0; j < kResolution; j++) {
+			const dlib::rgb_pixel& p = img(i, j);
+			*dst++ = p.red / 255.0f;
+			*dst++ = p.green / 255.0f;
+			*dst++ = p.blue / 255.0f;
+		}
+	}
+	return true;
+}
+
+
+struct Result
+{
+	ModelVariant variant;
+	double loadSeconds = 0;
+	size_t loadBytes = 0;
+	double latencyMs = 0;
+	double fps = 0;
+	float meanError = 0;
+	float p95Error = 0;
+	float maxError = 0;
+};
+
+
+static std::vector<FloatTensor> run(const ModelConfig& config,
+			int batchSize, const std::vector<FloatTensor>& crops,
+			Result& result)
+{
+	// the process doesn't always shrink after a model is freed, the
+	// growth of the later ones may be underestimated
+	size_t before = trace::residentBytes();
+	auto start = std::chrono::steady_clock::now();
+	PRNet net(config, batchSize);
+	result.loadSeconds = seconds(start);
+	size_t after = trace::residentBytes();
+	result.loadBytes = after > before ? after - before : 0;
+	result.variant = net.variant();
+
+	// warm-up, the first run allocates and autotunes
+	net.infer(crops.at(0));
+
+	std::vector<double> times;
+	std::vector<FloatTensor> outputs;
+	for (auto& crop : crops) {
+		start = std::chrono::steady_clock::now();
+		outputs.push_back(net.infer(crop));
+		times.push_back(seconds(start));
+	}
+	std::sort(times.begin(), times.end());
+	result.latencyMs = times[times.size() / 2] * 1000;
+
+	start = std::chrono::steady_clock::now();
+	net.inferBatch(crops);
+	result.fps = crops.size() / seconds(start);
+	return outputs;
+}
+
+
+// Distances between the face's vertices of two position maps
+static void vertexErrors(const FloatTensor& a, const FloatTensor& b,
+			IndexView faceIndices, std::vector<float>& errors)
+{
+	if (a.dims() != 4 || b.dims() != 4)
+		return;
+	const float* pa = a.data();
+	const float* pb = b.data();
+	for (int index : faceIndices) {
+		float d = 0;
+		for (int c = 0; c < 3; c++) {
+			float v = pa[index * 3 + c] - pb[index * 3 + c];
+			d += v * v;
+		}
+		errors.push_back(std::sqrt(d) * kPositionScale);
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = "data";
+	int batchSize = kDefaultBatchSize;
+	BackendType backend = kDefaultBackend;
+	std::vector<std::string> paths;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-d" && i + 1 < argc)
+			dataPath = argv[++i];
+		else if (arg == "-b" && i + 1 < argc)
+			batchSize = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "-e" && i + 1 < argc)
+			parseBackend(argv[++i], backend);
+		else
+			paths.push_back(arg);
+	}
+
+	std::vector<FloatTensor> crops;
+	for (auto& path : paths) {
+		FloatTensor crop;
+		if (loadCrop(path, crop))
+			crops.push_back(crop);
+		else
+			std::cout << "Skipping " << path << ", not a "
+				<< kResolution << "x" << kResolution << " crop\n";
+	}
+	if (crops.empty()) {
+		std::cout << "No crops, the errors are of noise\n";
+		std::mt19937 rng(0);
+		std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+		for (int i = 0; i < kRandomCrops; i++) {
+			FloatTensor t(1, kResolution, kResolution, 3);
+			for (int64_t j = 0; j < t.size(); j++)
+				t.data()[j] = dist(rng);
+			crops.push_back(t);
+		}
+	}
+
+	std::string dir = dataPath + "/uv-data/";
+	FaceAssets assets;
+	if (!assets.map(dir + kStaticAssetName, kResolution))
+		assets.loadText(dir + "triangles.txt", dir + "face_ind.txt",
+				dir + "uv_kpt_ind.txt", kResolution);
+
+	std::string model = dataPath + "/net-data/256_256_resfcn256_weight";
+	std::vector<Result> results;
+	std::vector<FloatTensor> reference;
+	for (ModelVariant variant : { kFrozen, kHalf, kInt8 }) {
+		Result result;
+		std::vector<FloatTensor> outputs = run(
+				ModelConfig(model, variant, backend),
+				batchSize, crops, result);
+		if (variant == kFrozen) {
+			if (result.variant != kFrozen) {
+				std::cout << "No float model on "
+					<< backendName(backend) << "\n";
+				return 1;
+			}
+			reference = outputs;
+		} else if (result.variant != variant) {
+			// it's fallen back to the float one
+			continue;
+		}
+
+		std::vector<float> errors;
+		for (size_t i = 0; i < outputs.size(); i++)
+			vertexErrors(reference[i], outputs[i],
+					assets.faceIndices(), errors);
+		if (!errors.empty()) {
+			std::sort(errors.begin(), errors.end());
+			double sum = 0;
+			for (float e : errors)
+				sum += e;
+			result.meanError = sum / errors.size();
+			result.p95Error = errors[std::min(errors.size() - 1,
+						errors.size() * 95 / 100)];
+			result.maxError = errors.back();
+		}
+		results.push_back(result);
+	}
+
+	std::printf("%zu crops, errors in pixels against the float model\n",
+							crops.size());
+	std::printf("%-8s %8s %8s %10s %8s %8s %8s %8s\n", "model",
+		"load s", "MB", "median ms", "fps", "mean px", "p95 px",
+		"max px");
+	for (const Result& r : results) {
+		std::printf("%-8s %8.2f %8zu %10.2f %8.1f %8.3f %8.3f %8.3f\n",
+			modelVariantName(r.variant), r.loadSeconds,
+			r.loadBytes >> 20, r.latencyMs, r.fps, r.meanError,
+			r.p95Error, r.maxError);
+	}
+	return 0;
+}
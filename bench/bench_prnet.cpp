@@ -0,0 +1,148 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Compares loading and running the meta graph against the frozen one,
+// if freeze_graph.py has made it, and against the ONNX model on ONNX
+// Runtime if it's built, and the throughput of the single frame
+// PRNet::infer() against PRNet::inferBatch() for several batch sizes on
+// random face crops.
+//
+// usage: bench_prnet [data dir] [frames] [batch size ...]
+
+#include "../src/prnet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <iostream>
+#include <random>
+
+
+static const int kResolution = 256;
+
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double> d =
+		std::chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+
+// median single frame latency after a warm-up run
+static double latency(PRNet& net, const std::vector<FloatTensor>& imgs)
+{
+	net.infer(imgs.at(0));
+	std::vector<double> times;
+	for (auto& img : imgs) {
+		auto start = std::chrono::steady_clock::now();
+		net.infer(img);
+		times.push_back(seconds(start));
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+
+static float maxDifference(PRNet& a, PRNet& b,
+			const std::vector<FloatTensor>& imgs)
+{
+	float diff = 0;
+	for (auto& img : imgs) {
+		FloatTensor ta = a.infer(img);
+		FloatTensor tb = b.infer(img);
+		if (ta.dims() != 4 || tb.dims() != 4)
+			return INFINITY;
+		for (int64_t j = 0; j < ta.size(); j++)
+			diff = std::max(diff,
+				std::abs(ta.data()[j] - tb.data()[j]));
+	}
+	return diff;
+}
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = argc > 1 ? argv[1] : "data";
+	int frames = argc > 2 ? std::atoi(argv[2]) : 64;
+	std::vector<int> batchSizes;
+	for (int i = 3; i < argc; i++)
+		batchSizes.push_back(std::atoi(argv[i]));
+	if (batchSizes.empty())
+		batchSizes = { 1, 2, 4, 8, 16 };
+
+	std::string model = dataPath + "/net-data/256_256_resfcn256_weight";
+
+	std::mt19937 rng(0);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+	std::vector<FloatTensor> imgs;
+	for (int i = 0; i < frames; i++) {
+		FloatTensor t(1, kResolution, kResolution, 3);
+		for (int64_t j = 0; j < t.size(); j++)
+			t.data()[j] = dist(rng);
+		imgs.push_back(t);
+	}
+
+	// the reference, what the checkpoint gives
+	auto start = std::chrono::steady_clock::now();
+	std::unique_ptr<PRNet> metaNet(new PRNet(ModelConfig(
+				model, kMetaGraph, kTensorFlowBackend)));
+	if (metaNet->loaded())
+		std::cout << "meta graph: load " << seconds(start) << " s, "
+			<< latency(*metaNet, imgs) * 1000 << " ms\n";
+
+	for (int b = 0; b < kNumBackends; b++) {
+		BackendType backend = (BackendType)b;
+		start = std::chrono::steady_clock::now();
+		PRNet frozen(ModelConfig(model, kFrozen, backend));
+		if (!frozen.loaded() || frozen.variant() != kFrozen)
+			continue;
+		std::cout << backendName(backend) << " frozen: load "
+			<< seconds(start) << " s, "
+			<< latency(frozen, imgs) * 1000 << " ms";
+		if (metaNet->loaded())
+			std::cout << ", max difference "
+				<< maxDifference(*metaNet, frozen, imgs);
+		std::cout << "\n";
+	}
+	metaNet.reset();
+
+	PRNet net{ModelConfig(model)};
+	if (!net.loaded())
+		return 1;
+
+	// warm-up, the first run allocates and autotunes
+	net.infer(imgs.at(0));
+
+	start = std::chrono::steady_clock::now();
+	for (auto& img : imgs)
+		net.infer(img);
+	double single = seconds(start);
+	std::cout << "single: " << frames / single << " fps\n";
+
+	for (int batchSize : batchSizes) {
+		net.setBatchSize(batchSize);
+		start = std::chrono::steady_clock::now();
+		net.inferBatch(imgs);
+		double batched = seconds(start);
+		std::cout << "batch " << batchSize << ": "
+			<< frames / batched << " fps, x"
+			<< single / batched << "\n";
+	}
+	return 0;
+}
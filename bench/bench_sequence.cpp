@@ -0,0 +1,295 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Writes a synthetic take into sequence files of each encoding and plays
+// them back: the size of the file, the time to write a frame, the frames
+// a second of the first and of a repeated pass over the mapped file and
+// of reading the key points only. The points read back are checked
+// against the written ones within what the encoding keeps, so is a file
+// read while it's written and a file continued after closing it, it
+// exits with 1 if any of them fails.
+//
+// usage: bench_sequence [-d data dir] [-n frames] [-f faces] [-o dir]
+//   the points are of the face's layout if face_ind.txt is there
+
+#include "../src/faceassets.h"
+#include "../src/sequencefile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+
+static const int kResolution = 256;
+static const int kNumKpts = 68;
+// about the size of a face filling a HD frame in pixels
+static const float kFaceSize = 600;
+
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double> d =
+		std::chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+
+// A face's points wobbling from frame to frame, roughly a half sphere
+static void makeFace(const SequenceLayout& layout, int frame, int face,
+						Point3List& points)
+{
+	std::mt19937 rng(frame * 131 + face);
+	std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+	float x0 = 200 + face * kFaceSize + frame * 1.5f;
+	float y0 = 300 + std::sin(frame * 0.1f) * 40;
+	points.resize(layout.numPoints());
+	for (size_t i = 0; i < points.size(); i++) {
+		int texel = layout.indices.empty() ? i : layout.indices[i];
+		float u = (float)(texel % kResolution) / kResolution - 0.5f;
+		float v = (float)(texel / kResolution) / kResolution - 0.5f;
+		float z = std::sqrt(std::max(0.0f, 0.25f - u * u - v * v));
+		points[i].set(x0 + u * kFaceSize + noise(rng),
+				y0 + v * kFaceSize + noise(rng),
+				z * kFaceSize + noise(rng));
+	}
+}
+
+
+static float coord(const Point3& p, int c)
+{
+	return c == 0 ? p.x : c == 1 ? p.y : p.z;
+}
+
+
+// The largest difference a point may have for each axis, of the face's
+// extent along the axis
+static float tolerance(PointEncoding encoding, float extent)
+{
+	switch (encoding) {
+	case kHalfPoints:
+		// half of the last of 11 bits of the mantissa
+		return extent / 2048 + 1e-3f;
+	case kInt16Points:
+		// half of a step of 1/65535
+		return extent / 131070 + 1e-3f;
+	default:
+		return 0;
+	}
+}
+
+
+static bool check(const SequenceReader& reader, const SequenceLayout& layout,
+			int frame, int numFaces, float& maxError)
+{
+	if (reader.numFaces(frame) != numFaces)
+		return false;
+	Point3List expected, points(reader.numPoints());
+	for (int f = 0; f < numFaces; f++) {
+		makeFace(layout, frame, f, expected);
+		if (reader.faceId(frame, f) != f ||
+				!reader.read(frame, f, points.data()))
+			return false;
+		float lo[3], hi[3];
+		for (int c = 0; c < 3; c++) {
+			lo[c] = hi[c] = coord(expected[0], c);
+			for (auto& p : expected) {
+				lo[c] = std::min(lo[c], coord(p, c));
+				hi[c] = std::max(hi[c], coord(p, c));
+			}
+		}
+		for (size_t i = 0; i < points.size(); i++) {
+			for (int c = 0; c < 3; c++) {
+				float d = std::abs(coord(points[i], c) -
+						coord(expected[i], c));
+				maxError = std::max(maxError, d);
+				if (d > tolerance(reader.encoding(),
+							hi[c] - lo[c]))
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+static bool writeTake(SequenceWriter& writer, const SequenceLayout& layout,
+				int first, int last, int numFaces)
+{
+	std::vector<Point3List> faces(numFaces);
+	std::vector<const Point3*> pointers(numFaces);
+	std::vector<int> ids(numFaces);
+	for (int frame = first; frame < last; frame++) {
+		for (int f = 0; f < numFaces; f++) {
+			makeFace(layout, frame, f, faces[f]);
+			pointers[f] = faces[f].data();
+			ids[f] = f;
+		}
+		if (!writer.write(frame, ids, pointers))
+			return false;
+	}
+	return true;
+}
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = "data";
+	std::string outDir = "/tmp";
+	int numFrames = 240;
+	int numFaces = 1;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-d" && i + 1 < argc)
+			dataPath = argv[++i];
+		else if (arg == "-n" && i + 1 < argc)
+			numFrames = std::max(2, std::atoi(argv[++i]));
+		else if (arg == "-f" && i + 1 < argc)
+			numFaces = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "-o" && i + 1 < argc)
+			outDir = argv[++i];
+	}
+
+	SequenceLayout layout;
+	layout.resolution = kResolution;
+	std::string dir = dataPath + "/uv-data/";
+	FaceAssets assets;
+	if (!assets.map(dir + kStaticAssetName, kResolution))
+		assets.loadText(dir + "triangles.txt", dir + "face_ind.txt",
+				dir + "uv_kpt_ind.txt", kResolution);
+	IndexView faceIndices = assets.faceIndices();
+	layout.indices.assign(faceIndices.begin(), faceIndices.end());
+	if (layout.indices.empty())
+		std::cout << "No face_ind.txt, the points are the whole map\n";
+	// the key points are any points, it's the reading of a few of them
+	// which is measured
+	for (int i = 0; i < kNumKpts; i++)
+		layout.kptIndices.push_back(i * (layout.numPoints() / kNumKpts));
+
+	std::printf("%d frames of %d faces of %zu points\n", numFrames,
+					numFaces, layout.numPoints());
+	std::printf("%-6s %10s %10s %10s %10s %10s %10s %10s\n", "coding",
+		"MB", "KB/frame", "write ms", "first fps", "again fps",
+		"kpts fps", "max err");
+
+	bool ok = true;
+	for (int e = 0; e < kNumPointEncodings; e++) {
+		PointEncoding encoding = (PointEncoding)e;
+		std::string path = outDir + "/bench_sequence_" +
+				pointEncodingName(encoding) + ".ffsq";
+		std::remove(path.c_str());
+
+		SequenceWriter writer;
+		if (!writer.open(path, layout, encoding)) {
+			std::cout << "Can't write " << path << "\n";
+			return 1;
+		}
+		// the points are made outside the timing
+		std::vector<Point3List> faces(numFaces);
+		std::vector<const Point3*> pointers(numFaces);
+		std::vector<int> ids(numFaces);
+		double writeSeconds = 0;
+		for (int frame = 0; frame < numFrames; frame++) {
+			for (int f = 0; f < numFaces; f++) {
+				makeFace(layout, frame, f, faces[f]);
+				pointers[f] = faces[f].data();
+				ids[f] = f;
+			}
+			auto start = std::chrono::steady_clock::now();
+			ok = writer.write(frame, ids, pointers) && ok;
+			writeSeconds += seconds(start);
+		}
+		ok = writer.close() && ok;
+
+		SequenceReader reader;
+		if (!reader.open(path) || !reader.complete() ||
+				(int)reader.frames().size() != numFrames) {
+			std::cout << "Can't read " << path << " back\n";
+			return 1;
+		}
+
+		Point3List points(layout.numPoints());
+		double passes[2];
+		for (double& pass : passes) {
+			auto start = std::chrono::steady_clock::now();
+			for (int frame : reader.frames()) {
+				for (int f = 0; f < reader.numFaces(frame); f++)
+					reader.read(frame, f, points.data());
+			}
+			pass = numFrames / seconds(start);
+		}
+		IndexView kpts = reader.kptIndices();
+		auto start = std::chrono::steady_clock::now();
+		for (int frame : reader.frames())
+			reader.read(frame, 0, kpts, points.data());
+		double kptFps = numFrames / seconds(start);
+
+		float maxError = 0;
+		for (int frame = 0; frame < numFrames; frame++) {
+			if (!check(reader, layout, frame, numFaces, maxError)) {
+				std::cout << pointEncodingName(encoding)
+					<< ": frame " << frame
+					<< " doesn't match\n";
+				ok = false;
+				break;
+			}
+		}
+
+		std::printf("%-6s %10.2f %10.1f %10.3f %10.0f %10.0f %10.0f "
+			"%10.4f\n", pointEncodingName(encoding),
+			reader.fileSize() / 1048576.0,
+			reader.fileSize() / 1024.0 / numFrames,
+			writeSeconds * 1000 / numFrames, passes[0], passes[1],
+			kptFps, maxError);
+	}
+
+	// a take being written is read up to its last frame, closing and
+	// opening it again continues it
+	std::string path = outDir + "/bench_sequence_partial.ffsq";
+	std::remove(path.c_str());
+	int half = numFrames / 2;
+	float maxError = 0;
+	{
+		SequenceWriter writer;
+		SequenceReader reader;
+		ok = writer.open(path, layout, kHalfPoints) &&
+			writeTake(writer, layout, 0, half, numFaces) &&
+			reader.open(path) && !reader.complete() &&
+			(int)reader.frames().size() == half &&
+			check(reader, layout, half - 1, numFaces, maxError) &&
+			ok;
+	}
+	{
+		SequenceWriter writer;
+		SequenceReader reader;
+		ok = writer.open(path, layout, kHalfPoints) &&
+			writer.contains(half - 1) && !writer.contains(half) &&
+			writeTake(writer, layout, half, numFrames, numFaces) &&
+			writer.close() && reader.open(path) &&
+			reader.complete() &&
+			(int)reader.frames().size() == numFrames &&
+			check(reader, layout, 0, numFaces, maxError) &&
+			check(reader, layout, numFrames - 1, numFaces,
+							maxError) && ok;
+	}
+
+	std::cout << (ok ? "All frames read back\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Checks the table based linear to sRGB conversion against the pow()
+// reference and compares their throughput on a UHD frame.
+//
+// usage: bench_srgb [step], every step-th float bit pattern in [-2, 2)
+// is checked, 1 checks all of them and takes a while
+
+#include "../src/srgb.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+
+static double milliseconds(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double, std::milli> d =
+		std::chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+
+int main(int argc, char** argv)
+{
+	uint32_t step = argc > 1 ? std::max(1, std::atoi(argv[1])) : 7;
+
+	auto start = std::chrono::steady_clock::now();
+	srgb::table();
+	std::printf("table: %.2f ms\n", milliseconds(start));
+
+	// both signs up to 2.0f
+	uint64_t checked = 0, mismatches = 0;
+	int maxDiff = 0;
+	for (uint32_t sign = 0; sign < 2; sign++) {
+		for (uint64_t bits = 0; bits < 0x40000000; bits += step) {
+			uint32_t b = (uint32_t)bits | sign << 31;
+			float c;
+			std::memcpy(&c, &b, sizeof(c));
+			int d = std::abs(srgb::linear2srgb(c) -
+					srgb::linear2srgbReference(c));
+			if (d) {
+				mismatches++;
+				maxDiff = std::max(maxDiff, d);
+			}
+			checked++;
+		}
+	}
+	std::printf("checked %llu values: %llu mismatches, max diff %d\n",
+		(unsigned long long)checked, (unsigned long long)mismatches,
+		maxDiff);
+
+	// interleaved RGB of a UHD frame, mostly in [0, 1] like a plate
+	const int w = 3840, h = 2160;
+	std::vector<float> plane(w * h * 3);
+	std::mt19937 rng(0);
+	std::uniform_real_distribution<float> dist(-0.05f, 1.2f);
+	for (auto& v : plane)
+		v = dist(rng);
+	std::vector<unsigned char> ref(plane.size()), out(plane.size());
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < plane.size(); i++)
+		ref[i] = srgb::linear2srgbReference(plane[i]);
+	double refMs = milliseconds(start);
+
+	start = std::chrono::steady_clock::now();
+	for (int y = 0; y < h; y++) {
+		for (int c = 0; c < 3; c++) {
+			size_t row = (size_t)y * w * 3 + c;
+			srgb::linear2srgbRow(&plane[row], 3, &out[row], 3, w);
+		}
+	}
+	double rowMs = milliseconds(start);
+
+	size_t rowMismatches = 0;
+	for (size_t i = 0; i < plane.size(); i++)
+		rowMismatches += ref[i] != out[i];
+
+	std::printf("UHD frame: reference %.2f ms, rows %.2f ms, x%.1f, "
+		"%zu mismatches\n", refMs, rowMs, refMs / rowMs,
+		rowMismatches);
+	return mismatches || rowMismatches ? 1 : 0;
+}
@@ -0,0 +1,274 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Times every stage of the fitting pipeline in isolation on synthetic
+// frames and, if given, on real images resampled to HD and UHD.
+// Prints median/p95 latency and operator new calls per run of a stage,
+// -j writes the same as JSON for comparing builds.
+//
+// usage: bench_stages [-d data dir] [-n iterations] [-j out.json] [image ...]
+
+#include "bench_util.h"
+#include "../src/imageio.h"
+#include "../src/nuke2tf.h"
+#include "../src/prnet.h"
+
+#include <dlib/image_transforms.h>
+#include <cstdlib>
+#include <random>
+
+using namespace dlib;
+
+
+static const int kResolution = 256;
+
+
+class StageBenchmark {
+public:
+	StageBenchmark(Nuke2TensorFlow::StaticData& data, PRNet& net,
+			int iterations, BenchReport& report) :
+		_n2tf(kResolution),
+		_data(data),
+		_net(net),
+		_iterations(iterations),
+		_report(report)
+	{
+	}
+
+	void run(const std::string& frameName, const LinearImage& image);
+
+private:
+	Nuke2TensorFlow _n2tf;
+	Nuke2TensorFlow::StaticData& _data;
+	PRNet& _net;
+	int _iterations;
+	BenchReport& _report;
+
+	template <typename F>
+	void add(const std::string& stage, const std::string& frameName,
+			const LinearImage& image, F f)
+	{
+		StageStats stats = measure(stage, _iterations, f);
+		stats.frame = frameName;
+		stats.width = image.width;
+		stats.height = image.height;
+		_report.add(stats);
+	}
+
+	void recreatePrimitives(std::vector<int>& corners);
+};
+
+
+void StageBenchmark::run(const std::string& frameName,
+				const LinearImage& image)
+{
+	ImageView view = image.view();
+	matrix<rgb_pixel> img;
+	// the whole frame, the pipeline converts only the warped region
+	add("plane2img", frameName, image, [&] {
+		_n2tf.plane2img(view, rectangle(0, 0, image.width - 1,
+						image.height - 1), img);
+	});
+
+	std::vector<rectangle> faces;
+	bool found = false;
+	add("detect", frameName, image, [&] {
+		found = _n2tf.detect(view, faces);
+	});
+	rectangle bbox;
+	// synthetic frames have no faces, a box in the middle then
+	if (found) {
+		bbox = faces.front();
+	} else {
+		long size = image.height / 3;
+		long l = image.width / 2 - size / 2;
+		long t = image.height / 2 - size / 2;
+		bbox = rectangle(l, t, l + size, t + size);
+	}
+
+	FloatTensor tensor(1, kResolution, kResolution, 3);
+	FaceCrop crop;
+	crop.planeHeight = image.height;
+	add("extractFaceTensor", frameName, image, [&] {
+		_n2tf.extractFaceTensor(view, bbox.left(), bbox.right(),
+				bbox.top(), bbox.bottom(), found,
+				tensor, 0, crop);
+	});
+
+	FloatTensor output;
+	add("infer", frameName, image, [&] {
+		output = _net.infer(tensor);
+	});
+	if (output.dims() != 4)
+		return;
+
+	// the whole map, then the points of the mesh's and the key
+	// points' modes alone
+	Point3List points;
+	add("extractDataFromTensor", frameName, image, [&] {
+		_n2tf.extractDataFromTensor(output, crop, points);
+	});
+	add("extract face", frameName, image, [&] {
+		_n2tf.extractDataFromTensor(output, crop, points,
+				_data.faceLayout().indices);
+	});
+	add("extract key points", frameName, image, [&] {
+		_n2tf.extractDataFromTensor(output, crop, points,
+				_data.kptLayout().indices);
+	});
+
+	// the hand-off of the face's points into the geometry's, through
+	// the instance's and the op's buffers as it used to be, and
+	// extracted straight into the geometry's
+	const PointLayout& face = _data.faceLayout();
+	Point3List buffer, geometry;
+	add("handoff buffered", frameName, image, [&] {
+		_n2tf.extractDataFromTensor(output, crop, points,
+							face.indices);
+		buffer.assign(points.begin(), points.end());
+		geometry.assign(buffer.begin(), buffer.end());
+	});
+	add("handoff direct", frameName, image, [&] {
+		geometry.resize(face.size(kResolution));
+		_n2tf.extractDataFromTensor(output, crop, face,
+							geometry.data());
+	});
+
+	std::vector<int> corners;
+	add("recreate_primitives", frameName, image, [&] {
+		recreatePrimitives(corners);
+	});
+	// the topologies the static data has made once, a walk over them
+	add("primitives shared", frameName, image, [&] {
+		corners.clear();
+		for (const Topology* topo : { &_data.meshTopology(),
+						&_data.kptTopology() }) {
+			for (int index : topo->triangles)
+				corners.push_back(index);
+			for (int index : topo->points)
+				corners.push_back(index);
+			for (int index : topo->lines)
+				corners.push_back(index);
+		}
+	});
+}
+
+
+// The index work FaceFitOp::recreate_primitives() did per op before the
+// topologies were shared, without creating Nuke's primitives
+void StageBenchmark::recreatePrimitives(std::vector<int>& corners)
+{
+	auto tris = _data.triIndices();
+	corners.clear();
+	for (size_t i = 2; i < tris.size(); i += 3) {
+		corners.push_back(tris[i]);
+		corners.push_back(tris[i - 1]);
+		corners.push_back(tris[i - 2]);
+	}
+
+	auto endList = _data.endList();
+	size_t numKpts = _data.kptLayout().indices.size();
+	for (size_t i = 0; i < numKpts; i++) {
+		corners.push_back(i);
+		if (endList.find(i) != endList.end())
+			continue;
+		corners.push_back(i + 1);
+	}
+}
+
+
+static void syntheticFrame(int w, int h, LinearImage& image)
+{
+	std::mt19937 rng(w);
+	std::uniform_real_distribution<float> noise(0.0f, 0.05f);
+	image.width = w;
+	image.height = h;
+	image.pixels.resize(w * h * 3);
+	for (int i = 0; i < h; i++) {
+		for (int j = 0; j < w; j++) {
+			float* p = &image.pixels[(i * w + j) * 3];
+			p[0] = (float)j / w + noise(rng);
+			p[1] = (float)i / h + noise(rng);
+			p[2] = 0.5f + noise(rng);
+		}
+	}
+}
+
+
+static const int kSizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = "data";
+	std::string jsonPath;
+	int iterations = 10;
+	std::vector<std::string> paths;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-d" && i + 1 < argc)
+			dataPath = argv[++i];
+		else if (arg == "-n" && i + 1 < argc)
+			iterations = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "-j" && i + 1 < argc)
+			jsonPath = argv[++i];
+		else
+			paths.push_back(arg);
+	}
+
+	std::string model = dataPath + "/net-data/256_256_resfcn256_weight";
+	Nuke2TensorFlow::StaticData data(
+		dataPath + "/net-data/mmod_human_face_detector.dat",
+		dataPath + "/uv-data/triangles.txt",
+		dataPath + "/uv-data/face_ind.txt",
+		dataPath + "/uv-data/uv_kpt_ind.txt",
+		kResolution,
+		dataPath + "/uv-data/" + kStaticAssetName);
+	PRNet net{ModelConfig(model)};
+
+	BenchReport report("stages");
+	StageBenchmark bench(data, net, iterations, report);
+	BenchReport::printHeader();
+
+	for (auto& size : kSizes) {
+		LinearImage image;
+		syntheticFrame(size[0], size[1], image);
+		bench.run("synthetic", image);
+	}
+
+	for (auto& path : paths) {
+		matrix<rgb_pixel> img;
+		if (!loadImage(path, img)) {
+			std::cout << "Couldn't read " << path << "\n";
+			continue;
+		}
+		std::string name = path.substr(path.rfind('/') + 1);
+		for (auto& size : kSizes) {
+			matrix<rgb_pixel> resized(size[1], size[0]);
+			resize_image(img, resized);
+			LinearImage image;
+			rgb2linear(resized, image);
+			bench.run(name, image);
+		}
+	}
+
+	if (!jsonPath.empty() && !report.writeJson(jsonPath)) {
+		std::cout << "Couldn't write " << jsonPath << "\n";
+		return 1;
+	}
+	return 0;
+}
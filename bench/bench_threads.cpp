@@ -0,0 +1,241 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Renders with several nodes at once under different thread budgets: each
+// node is a thread cropping a synthetic HD frame, running it through the
+// shared pool of sessions and extracting the points, like FaceFitOp does
+// on Nuke's threads. Optionally "Nuke's" own workers spin meanwhile, their
+// work shows what the budget leaves to the rest of the comp.
+//
+// usage: bench_threads [-d data dir] [-k nodes] [-n frames per node]
+//                      [-s sessions] [-w workers] [-p first core]
+//                      [-e backend] [budget...]
+//   budgets are thread counts, 0 for the runtimes' defaults, by default
+//   0, 1, 2, 4... up to the number of cores. With -p they're pinned to
+//   the cores from the given one.
+
+#include "../src/imageio.h"
+#include "../src/inferpool.h"
+#include "../src/nuke2tf.h"
+#include "../src/threadbudget.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace dlib;
+
+
+static const int kResolution = 256;
+static const int kFrameWidth = 1920;
+static const int kFrameHeight = 1080;
+
+typedef std::chrono::steady_clock Clock;
+
+
+static double since(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+static void syntheticFrame(int w, int h, LinearImage& image)
+{
+	image.width = w;
+	image.height = h;
+	image.pixels.resize(w * h * 3);
+	for (int i = 0; i < h; i++) {
+		for (int j = 0; j < w; j++) {
+			float* p = &image.pixels[(i * w + j) * 3];
+			p[0] = (float)j / w;
+			p[1] = (float)i / h;
+			p[2] = 0.5f;
+		}
+	}
+}
+
+
+struct Result
+{
+	double fps = 0;
+	double medianMs = 0;
+	double p95Ms = 0;
+	// millions of iterations of the workers' loop per second
+	double workerRate = 0;
+};
+
+
+static Result render(InferencePool& pool, const LinearImage& image,
+			int numNodes, int numFrames, int numWorkers)
+{
+	ImageView view = image.view();
+	long size = image.height / 3;
+	long l = image.width / 2 - size / 2;
+	long t = image.height / 2 - size / 2;
+	rectangle box(l, t, l + size, t + size);
+
+	std::atomic<bool> stop(false);
+	std::atomic<int64_t> work(0);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < numWorkers; i++) {
+		workers.emplace_back([&] {
+			float x = 1.0f;
+			int64_t n = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				for (int j = 0; j < 1000; j++)
+					x = x * 0.999f + 0.001f;
+				n++;
+			}
+			// keeps the loop from being optimised away
+			work += n + (x > 2.0f);
+		});
+	}
+
+	std::vector<std::vector<double>> times(numNodes);
+	std::vector<std::thread> nodes;
+	auto start = Clock::now();
+	for (int i = 0; i < numNodes; i++) {
+		nodes.emplace_back([&, i] {
+			Nuke2TensorFlow n2tf(kResolution);
+			Point3List points(kResolution * kResolution);
+			for (int f = 0; f < numFrames; f++) {
+				auto frameStart = Clock::now();
+				FloatTensor input = n2tf.imagePlane2Tensor(
+							view, box, false);
+				FloatTensor output = pool.infer(input);
+				if (output.dims() == 4)
+					n2tf.extractDataFromTensor(output,
+							n2tf.crop(), points);
+				times[i].push_back(since(frameStart));
+			}
+		});
+	}
+	for (auto& node : nodes)
+		node.join();
+	double elapsed = since(start);
+	stop = true;
+	for (auto& worker : workers)
+		worker.join();
+
+	std::vector<double> all;
+	for (auto& t : times)
+		all.insert(all.end(), t.begin(), t.end());
+	std::sort(all.begin(), all.end());
+
+	Result result;
+	result.fps = all.size() / elapsed;
+	if (!all.empty()) {
+		result.medianMs = all[all.size() / 2] * 1000;
+		result.p95Ms = all[std::min(all.size() - 1,
+					all.size() * 95 / 100)] * 1000;
+	}
+	result.workerRate = work / elapsed / 1000.0;
+	return result;
+}
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = "data";
+	int numNodes = 4;
+	int numFrames = 16;
+	int numSessions = 1;
+	int numWorkers = 0;
+	int firstCore = -1;
+	BackendType backend = kDefaultBackend;
+	std::vector<int> budgets;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-d" && hasValue)
+			dataPath = argv[++i];
+		else if (arg == "-k" && hasValue)
+			numNodes = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "-n" && hasValue)
+			numFrames = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "-s" && hasValue)
+			numSessions = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "-w" && hasValue)
+			numWorkers = std::max(0, std::atoi(argv[++i]));
+		else if (arg == "-p" && hasValue)
+			firstCore = std::max(0, std::atoi(argv[++i]));
+		else if (arg == "-e" && hasValue)
+			parseBackend(argv[++i], backend);
+		else
+			budgets.push_back(std::max(0, std::atoi(argv[i])));
+	}
+	if (budgets.empty()) {
+		int cores = std::max(1u, std::thread::hardware_concurrency());
+		budgets.push_back(0);
+		for (int n = 1; n < cores; n *= 2)
+			budgets.push_back(n);
+		budgets.push_back(cores);
+	}
+
+	LinearImage image;
+	syntheticFrame(kFrameWidth, kFrameHeight, image);
+	ModelConfig config(dataPath + "/net-data/256_256_resfcn256_weight",
+						kFrozen, backend);
+
+	std::printf("%d nodes x %d frames, %d sessions, %d workers, %s\n",
+		numNodes, numFrames, numSessions, numWorkers,
+		backendName(backend));
+	std::printf("%-10s %8s %10s %10s %12s\n", "threads", "fps",
+		"median ms", "p95 ms", "worker M/s");
+	// or the children print the buffered header again
+	std::fflush(stdout);
+	for (int threads : budgets) {
+		// a process per budget, TF's pools are process-wide and keep
+		// the size of the first session's, and the parent mustn't
+		// have started any threads to fork
+		pid_t pid = fork();
+		if (pid < 0) {
+			std::perror("fork");
+			return 1;
+		}
+		if (pid > 0) {
+			int status;
+			waitpid(pid, &status, 0);
+			continue;
+		}
+
+		ThreadBudget budget;
+		budget.threads = threads;
+		budget.firstCore = threads > 0 ? firstCore : -1;
+		setThreadBudget(budget);
+
+		InferencePool pool(config, numSessions);
+		pool.load(kResolution);
+		// the warm-up isn't timed, it waits for the loading too
+		render(pool, image, numNodes, numSessions, 0);
+
+		Result r = render(pool, image, numNodes, numFrames,
+							numWorkers);
+		std::printf("%-10s %8.1f %10.2f %10.2f %12.1f\n",
+			budget.str().c_str(), r.fps, r.medianMs, r.p95Ms,
+			r.workerRate);
+		std::fflush(stdout);
+		std::_Exit(0);
+	}
+	return 0;
+}
@@ -0,0 +1,68 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "bench_util.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> allocations(0);
+
+
+size_t allocationCount()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+
+void* operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+
+void operator delete[](void* p, size_t) noexcept
+{
+	std::free(p);
+}
@@ -0,0 +1,126 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+// Number of operator new calls in the whole process so far,
+// bench_util.cpp replaces the global operators for counting
+size_t allocationCount();
+
+
+struct StageStats
+{
+	std::string stage;
+	std::string frame;
+	int width = 0;
+	int height = 0;
+	int iterations = 0;
+	double medianMs = 0;
+	double p95Ms = 0;
+	double allocs = 0; // per iteration
+};
+
+
+// Runs f() the given number of times after a warm-up run
+template <typename F>
+StageStats measure(const std::string& stage, int iterations, F f)
+{
+	f();
+
+	std::vector<double> times;
+	size_t allocs = allocationCount();
+	for (int i = 0; i < iterations; i++) {
+		auto start = std::chrono::steady_clock::now();
+		f();
+		std::chrono::duration<double, std::milli> d =
+			std::chrono::steady_clock::now() - start;
+		times.push_back(d.count());
+	}
+	allocs = allocationCount() - allocs;
+
+	std::sort(times.begin(), times.end());
+	StageStats stats;
+	stats.stage = stage;
+	stats.iterations = iterations;
+	if (!times.empty()) {
+		stats.medianMs = times[times.size() / 2];
+		stats.p95Ms = times[std::min(times.size() - 1,
+					times.size() * 95 / 100)];
+		stats.allocs = (double)allocs / iterations;
+	}
+	return stats;
+}
+
+
+class BenchReport {
+public:
+	BenchReport(const std::string& name) : _name(name) {}
+
+	void add(const StageStats& stats)
+	{
+		_stats.push_back(stats);
+		std::printf("%-24s %-10s %5dx%-5d %10.3f %10.3f %10.1f\n",
+			stats.stage.c_str(), stats.frame.c_str(),
+			stats.width, stats.height, stats.medianMs,
+			stats.p95Ms, stats.allocs);
+		std::fflush(stdout);
+	}
+
+	static void printHeader()
+	{
+		std::printf("%-24s %-10s %11s %10s %10s %10s\n", "stage",
+			"frame", "size", "median ms", "p95 ms", "allocs");
+	}
+
+	// Machine-readable results for tracking regressions
+	bool writeJson(const std::string& path) const
+	{
+		FILE* f = std::fopen(path.c_str(), "w");
+		if (!f)
+			return false;
+		std::fprintf(f, "{\n  \"benchmark\": \"%s\",\n"
+				"  \"results\": [", _name.c_str());
+		for (size_t i = 0; i < _stats.size(); i++) {
+			const StageStats& s = _stats[i];
+			std::fprintf(f, "%s\n    {\"stage\": \"%s\", "
+				"\"frame\": \"%s\", \"width\": %d, "
+				"\"height\": %d, \"iterations\": %d, "
+				"\"median_ms\": %.4f, \"p95_ms\": %.4f, "
+				"\"allocs\": %.1f}",
+				i ? "," : "", s.stage.c_str(),
+				s.frame.c_str(), s.width, s.height,
+				s.iterations, s.medianMs, s.p95Ms, s.allocs);
+		}
+		std::fprintf(f, "\n  ]\n}\n");
+		return std::fclose(f) == 0;
+	}
+
+private:
+	std::string _name;
+	std::vector<StageStats> _stats;
+};
+
+
+#endif // BENCH_UTIL_H_
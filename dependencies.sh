@@ -168,6 +168,15 @@ if [ ! -e ./data/net-data/${MODEL_NAME}.meta ] ; then
   deactivate
 fi
 
+# ------------------------------------------------------
+# Freeze the graph, it's loaded instead if it's present
+# ------------------------------------------------------
+if [ ! -e ./data/net-data/${MODEL_NAME}_frozen.pb ] ; then
+  source ./env/bin/activate
+  ./freeze_graph.py
+  deactivate
+fi
+
 # ----------
 # Clone Dlib
 # ----------
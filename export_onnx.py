@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+
+# Exports the frozen graph freeze_graph.py has written into ONNX for the
+# ONNX Runtime backend, FACEFIT_BACKEND=onnx in the plug-in and
+# facefit_batch -e onnx. With int8 it also quantizes the exported model
+# statically, calibrated on the crops facefit_batch -c writes like
+# quantize_graph.py int8 does, FACEFIT_MODEL=int8 loads it.
+#
+# The float model is written only if it matches the frozen graph within
+# TOLERANCE on the crops, the difference of the int8 one is printed.
+#
+# usage: export_onnx.py [int8 [crop dir]]
+#   needs tf2onnx and onnxruntime, pip install tf2onnx onnxruntime
+
+import subprocess
+import sys
+
+import numpy as np
+import onnxruntime
+import tensorflow as tf
+from quantize_graph import (PRN_PATH, FROZEN_PATH, INPUT_NAME, OUTPUT_NAME,
+                            RESOLUTION_IN, CALIBRATION_BATCH, load_crops,
+                            run)
+
+ONNX_PATH = PRN_PATH + '.onnx'
+INT8_PATH = PRN_PATH + '_int8.onnx'
+
+OPSET = 11
+TOLERANCE = 1e-4
+
+
+def run_onnx(path, crops):
+    session = onnxruntime.InferenceSession(path)
+    results = []
+    for i in range(0, len(crops), CALIBRATION_BATCH):
+        results.append(session.run(
+            [OUTPUT_NAME + ':0'],
+            {INPUT_NAME + ':0': crops[i:i + CALIBRATION_BATCH]})[0])
+    return np.concatenate(results)
+
+
+def report(name, result, expected):
+    diff = np.abs(result - expected)
+    # the position map is scaled by 256 * 1.1 into pixels of the crop
+    scale = RESOLUTION_IN * 1.1
+    tf.logging.info("%s difference: mean %.3f px, max %.3f px (%g)", name,
+                    diff.mean() * scale, diff.max() * scale, diff.max())
+    return diff.max()
+
+
+def quantize(crops):
+    from onnxruntime.quantization import (CalibrationDataReader,
+                                          QuantFormat, QuantType,
+                                          quantize_static)
+
+    class CropReader(CalibrationDataReader):
+        def __init__(self):
+            self.batches = iter([
+                {INPUT_NAME + ':0': crops[i:i + CALIBRATION_BATCH]}
+                for i in range(0, len(crops), CALIBRATION_BATCH)])
+
+        def get_next(self):
+            return next(self.batches, None)
+
+    quantize_static(ONNX_PATH, INT8_PATH + '.tmp', CropReader(),
+                    quant_format=QuantFormat.QDQ,
+                    activation_type=QuantType.QUInt8,
+                    weight_type=QuantType.QInt8)
+    tf.gfile.Rename(INT8_PATH + '.tmp', INT8_PATH, overwrite=True)
+
+
+if __name__ == "__main__":
+    tf.logging.set_verbosity(tf.logging.INFO)
+
+    int8 = len(sys.argv) > 1 and sys.argv[1] == 'int8'
+    crop_dir = sys.argv[2] if len(sys.argv) > 2 else None
+
+    tf.logging.info("Exporting graph...")
+    subprocess.check_call([
+        sys.executable, '-m', 'tf2onnx.convert',
+        '--graphdef', FROZEN_PATH,
+        '--inputs', INPUT_NAME + ':0',
+        '--outputs', OUTPUT_NAME + ':0',
+        '--opset', str(OPSET),
+        '--output', ONNX_PATH + '.tmp',
+    ])
+
+    graph_def = tf.GraphDef()
+    with tf.gfile.GFile(FROZEN_PATH, 'rb') as f:
+        graph_def.ParseFromString(f.read())
+    crops = load_crops(crop_dir)
+    expected = run(graph_def, crops)
+
+    if report("Float", run_onnx(ONNX_PATH + '.tmp', crops),
+              expected) > TOLERANCE:
+        tf.logging.error("The exported model doesn't match, not saving it")
+        tf.gfile.Remove(ONNX_PATH + '.tmp')
+        sys.exit(1)
+    tf.gfile.Rename(ONNX_PATH + '.tmp', ONNX_PATH, overwrite=True)
+
+    if int8:
+        if crop_dir is None:
+            tf.logging.warning("Calibrating on noise, pass a directory of "
+                               "crops from facefit_batch -c")
+        tf.logging.info("Quantizing model...")
+        quantize(crops)
+        report("Int8", run_onnx(INT8_PATH, crops), expected)
@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+
+# Saves PRNet as a frozen inference graph for loading in C++ instead of
+# the meta graph and the checkpoint. The variables become constants,
+# batch norms are folded into the weights of the preceding convolutions,
+# constants are folded and the nodes the output doesn't depend on,
+# e.g. the regularizers and the saver, are stripped.
+#
+# The frozen graph is written only if its output matches the original
+# one's within TOLERANCE on random crops.
+
+import sys
+import time
+
+import numpy as np
+import tensorflow as tf
+from tensorflow.python.framework import tensor_util
+from tensorflow.tools.graph_transforms import TransformGraph
+from prnet.predictor import PosPrediction
+
+PRN_PATH = './data/net-data/256_256_resfcn256_weight'
+FROZEN_PATH = PRN_PATH + '_frozen.pb'
+
+RESOLUTION_IN = 256
+RESOLUTION_OUT = 256
+
+INPUT_NAME = 'Placeholder'
+OUTPUT_NAME = 'resfcn256/Conv2d_transpose_16/Sigmoid'
+
+# the output is a position map in 0..1, scaled by 256 * 1.1 later,
+# so it's about 3e-2 px
+TOLERANCE = 1e-4
+TEST_BATCH = 4
+TIMED_RUNS = 10
+
+
+def node_name(name):
+    return name.lstrip('^').split(':')[0]
+
+
+def fold_batch_norms(graph_def):
+    # TF's fold_old_batch_norms transform handles only Conv2D and
+    # MatMul, most of PRNet's batch norms follow Conv2DBackpropInput
+    nodes = {node.name: node for node in graph_def.node}
+    consumers = {}
+    for node in graph_def.node:
+        for name in node.input:
+            consumers.setdefault(node_name(name), []).append(node.name)
+
+    def constant(name):
+        node = nodes.get(node_name(name))
+        if node is None or node.op != 'Const':
+            return None
+        return node
+
+    folded = 0
+    for bn in list(graph_def.node):
+        if bn.op not in ('FusedBatchNorm', 'FusedBatchNormV3'):
+            continue
+        conv = nodes.get(node_name(bn.input[0]))
+        if conv is None or conv.op not in ('Conv2D', 'Conv2DBackpropInput'):
+            continue
+        if conv.op == 'Conv2D':
+            weights_input, out_axis = conv.input[1], 3
+        else:
+            # the transposed filters are [h, w, out, in]
+            weights_input, out_axis = conv.input[1], 2
+        weights_node = constant(weights_input)
+        params = [constant(name) for name in bn.input[1:5]]
+        if weights_node is None or None in params:
+            continue
+        # the weights are scaled in place, they mustn't be shared
+        if len(consumers.get(weights_node.name, [])) != 1:
+            continue
+
+        gamma, beta, mean, variance = [
+            tensor_util.MakeNdarray(p.attr['value'].tensor) for p in params]
+        scale = gamma / np.sqrt(variance + bn.attr['epsilon'].f)
+        shape = [1, 1, 1, 1]
+        shape[out_axis] = -1
+
+        weights = tensor_util.MakeNdarray(weights_node.attr['value'].tensor)
+        weights_node.attr['value'].CopyFrom(tf.AttrValue(
+            tensor=tensor_util.make_tensor_proto(
+                (weights * scale.reshape(shape)).astype(np.float32))))
+
+        bias = graph_def.node.add()
+        bias.op = 'Const'
+        bias.name = bn.name + '/folded_bias'
+        bias.attr['dtype'].CopyFrom(tf.AttrValue(type=tf.float32.as_datatype_enum))
+        bias.attr['value'].CopyFrom(tf.AttrValue(
+            tensor=tensor_util.make_tensor_proto(
+                (beta - mean * scale).astype(np.float32))))
+
+        # the batch norm becomes a bias add of the same name, so its
+        # consumers don't change
+        data_format = bn.attr['data_format'].s or b'NHWC'
+        inputs = [bn.input[0], bias.name]
+        bn.op = 'BiasAdd'
+        bn.ClearField('input')
+        bn.input.extend(inputs)
+        bn.ClearField('attr')
+        bn.attr['T'].CopyFrom(tf.AttrValue(type=tf.float32.as_datatype_enum))
+        bn.attr['data_format'].CopyFrom(tf.AttrValue(s=data_format))
+        folded += 1
+    return folded
+
+
+def freeze(sess):
+    graph_def = tf.graph_util.convert_variables_to_constants(
+        sess, sess.graph.as_graph_def(), [OUTPUT_NAME])
+    graph_def = tf.graph_util.remove_training_nodes(graph_def, [OUTPUT_NAME])
+    graph_def = TransformGraph(graph_def, [INPUT_NAME], [OUTPUT_NAME], [
+        'remove_nodes(op=Identity, op=CheckNumerics)',
+        'fold_constants(ignore_errors=true)',
+    ])
+    folded = fold_batch_norms(graph_def)
+    tf.logging.info("Folded %d batch norms", folded)
+    # the batch norms' parameters aren't used anymore
+    graph_def = tf.graph_util.extract_sub_graph(graph_def, [OUTPUT_NAME])
+    return TransformGraph(graph_def, [INPUT_NAME], [OUTPUT_NAME], [
+        'fold_constants(ignore_errors=true)',
+        'sort_by_execution_order',
+    ])
+
+
+def timed_run(sess, output, x, images):
+    sess.run(output, feed_dict={x: images})
+    start = time.time()
+    for _ in range(TIMED_RUNS):
+        result = sess.run(output, feed_dict={x: images})
+    return result, (time.time() - start) / TIMED_RUNS
+
+
+if __name__ == "__main__":
+    tf.logging.set_verbosity(tf.logging.INFO)
+
+    start = time.time()
+    pos_predictor = PosPrediction(RESOLUTION_IN, RESOLUTION_OUT)
+    pos_predictor.restore(PRN_PATH)
+    original_load = time.time() - start
+    original_nodes = len(pos_predictor.sess.graph.as_graph_def().node)
+
+    tf.logging.info("Freezing graph...")
+    frozen = freeze(pos_predictor.sess)
+
+    images = np.random.RandomState(0).rand(
+        TEST_BATCH, RESOLUTION_IN, RESOLUTION_IN, 3).astype(np.float32)
+    expected, original_time = timed_run(
+        pos_predictor.sess, pos_predictor.x_op, pos_predictor.x, images)
+
+    start = time.time()
+    graph = tf.Graph()
+    with graph.as_default():
+        tf.import_graph_def(frozen, name='')
+    sess = tf.Session(graph=graph)
+    frozen_load = time.time() - start
+    result, frozen_time = timed_run(
+        sess,
+        graph.get_tensor_by_name(OUTPUT_NAME + ':0'),
+        graph.get_tensor_by_name(INPUT_NAME + ':0'),
+        images)
+
+    diff = np.abs(result - expected).max()
+    tf.logging.info("Nodes: %d -> %d", original_nodes, len(frozen.node))
+    tf.logging.info("Load: %.3f s -> %.3f s", original_load, frozen_load)
+    tf.logging.info("Batch of %d: %.1f ms -> %.1f ms", TEST_BATCH,
+                    original_time * 1000, frozen_time * 1000)
+    tf.logging.info("Max difference: %g", diff)
+    if not diff <= TOLERANCE:
+        tf.logging.error("The frozen graph doesn't match, not saving it")
+        sys.exit(1)
+
+    tf.logging.info("Saving frozen graph...")
+    tf.train.write_graph(frozen, '.', FROZEN_PATH + '.tmp', as_text=False)
+    tf.gfile.Rename(FROZEN_PATH + '.tmp', FROZEN_PATH, overwrite=True)
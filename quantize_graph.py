@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+
+# Makes reduced precision variants of the frozen graph freeze_graph.py
+# has written, the plug-in loads them with FACEFIT_MODEL=fp16 or int8 and
+# facefit_batch with -m fp16 or int8.
+#
+#   fp16  the weights are stored as halves and cast to floats on load,
+#         half the size of the file, the arithmetic stays in floats
+#   int8  the convolutions, additions and activations the eight bit
+#         kernels support run on quantized tensors, with the ranges of
+#         the intermediate results calibrated on face crops, the
+#         transposed convolutions of the decoder stay in floats
+#
+# The crops are the PPMs facefit_batch -c writes, the network's input of
+# real footage. The mean and the maximum difference from the float graph
+# on them is printed, bench_precision measures the error in pixels.
+#
+# usage: quantize_graph.py fp16|int8 [crop dir]
+
+import glob
+import os
+import re
+import sys
+import tempfile
+
+import numpy as np
+import tensorflow as tf
+from tensorflow.python.framework import tensor_util
+from tensorflow.tools.graph_transforms import TransformGraph
+
+PRN_PATH = './data/net-data/256_256_resfcn256_weight'
+FROZEN_PATH = PRN_PATH + '_frozen.pb'
+
+RESOLUTION_IN = 256
+
+INPUT_NAME = 'Placeholder'
+OUTPUT_NAME = 'resfcn256/Conv2d_transpose_16/Sigmoid'
+
+# smaller constants, e.g. shapes and strides, aren't worth a cast
+MIN_HALF_ELEMENTS = 1024
+CALIBRATION_BATCH = 8
+# the crops are random noise without a directory, the ranges are a
+# lot wider than of faces then
+RANDOM_CROPS = 32
+
+
+def read_ppm(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    # a single whitespace before the pixels, which may be whitespace too
+    header = re.match(br'P6\s+(\d+)\s+(\d+)\s+255\s', data)
+    if not header:
+        raise ValueError(path + " isn't an 8 bit binary PPM")
+    width, height = int(header.group(1)), int(header.group(2))
+    pixels = np.frombuffer(data, dtype=np.uint8, count=width * height * 3,
+                           offset=header.end())
+    return pixels.reshape(height, width, 3).astype(np.float32) / 255.0
+
+
+def load_crops(crop_dir):
+    if crop_dir is None:
+        return np.random.RandomState(0).rand(
+            RANDOM_CROPS, RESOLUTION_IN, RESOLUTION_IN, 3).astype(np.float32)
+    crops = [read_ppm(path)
+             for path in sorted(glob.glob(os.path.join(crop_dir, '*.ppm')))]
+    crops = [c for c in crops if c.shape == (RESOLUTION_IN, RESOLUTION_IN, 3)]
+    if not crops:
+        raise ValueError("No %dx%d crops in %s" %
+                         (RESOLUTION_IN, RESOLUTION_IN, crop_dir))
+    return np.stack(crops)
+
+
+def run(graph_def, crops):
+    graph = tf.Graph()
+    with graph.as_default():
+        tf.import_graph_def(graph_def, name='')
+    x = graph.get_tensor_by_name(INPUT_NAME + ':0')
+    y = graph.get_tensor_by_name(OUTPUT_NAME + ':0')
+    results = []
+    with tf.Session(graph=graph) as sess:
+        for i in range(0, len(crops), CALIBRATION_BATCH):
+            results.append(sess.run(
+                y, feed_dict={x: crops[i:i + CALIBRATION_BATCH]}))
+    return np.concatenate(results)
+
+
+def half_weights(graph_def):
+    result = tf.GraphDef()
+    for node in graph_def.node:
+        value = node.attr['value'].tensor if node.op == 'Const' else None
+        if (value is None or value.dtype != tf.float32.as_datatype_enum or
+                np.prod([d.size for d in value.tensor_shape.dim]) <
+                MIN_HALF_ELEMENTS):
+            result.node.extend([node])
+            continue
+
+        # the cast gets the constant's name, so its consumers don't change
+        weights = tensor_util.MakeNdarray(value)
+        half = result.node.add()
+        half.op = 'Const'
+        half.name = node.name + '/half'
+        half.attr['dtype'].CopyFrom(
+            tf.AttrValue(type=tf.float16.as_datatype_enum))
+        half.attr['value'].CopyFrom(tf.AttrValue(
+            tensor=tensor_util.make_tensor_proto(weights.astype(np.float16))))
+
+        cast = result.node.add()
+        cast.op = 'Cast'
+        cast.name = node.name
+        cast.input.append(half.name)
+        cast.attr['SrcT'].CopyFrom(
+            tf.AttrValue(type=tf.float16.as_datatype_enum))
+        cast.attr['DstT'].CopyFrom(
+            tf.AttrValue(type=tf.float32.as_datatype_enum))
+    return result
+
+
+def eight_bit(graph_def, crops):
+    quantized = TransformGraph(graph_def, [INPUT_NAME], [OUTPUT_NAME], [
+        'add_default_attributes',
+        'quantize_weights',
+        'quantize_nodes',
+        'strip_unused_nodes',
+        'sort_by_execution_order',
+    ])
+
+    # the ranges of the requantizations are logged on the crops and
+    # then frozen into constants, TF's own calibration procedure
+    logged = TransformGraph(quantized, [INPUT_NAME], [OUTPUT_NAME], [
+        'insert_logging(op=RequantizationRange, show_name=true, '
+        'message="__requant_min_max:")',
+    ])
+    log = tempfile.NamedTemporaryFile(suffix='.log', delete=False)
+    # the logging goes to the native stderr
+    sys.stderr.flush()
+    stderr = os.dup(2)
+    os.dup2(log.fileno(), 2)
+    try:
+        run(logged, crops)
+    finally:
+        os.dup2(stderr, 2)
+        os.close(stderr)
+        log.close()
+
+    try:
+        return TransformGraph(quantized, [INPUT_NAME], [OUTPUT_NAME], [
+            'freeze_requantization_ranges(min_max_log_file="%s")' %
+            log.name,
+            'fold_constants(ignore_errors=true)',
+            'sort_by_execution_order',
+        ])
+    finally:
+        os.remove(log.name)
+
+
+if __name__ == "__main__":
+    tf.logging.set_verbosity(tf.logging.INFO)
+
+    if len(sys.argv) < 2 or sys.argv[1] not in ('fp16', 'int8'):
+        print("usage: quantize_graph.py fp16|int8 [crop dir]")
+        sys.exit(1)
+    variant = sys.argv[1]
+    crop_dir = sys.argv[2] if len(sys.argv) > 2 else None
+    variant_path = PRN_PATH + '_' + variant + '.pb'
+
+    graph_def = tf.GraphDef()
+    with tf.gfile.GFile(FROZEN_PATH, 'rb') as f:
+        graph_def.ParseFromString(f.read())
+
+    crops = load_crops(crop_dir)
+    tf.logging.info("%d crops", len(crops))
+    if crop_dir is None and variant == 'int8':
+        tf.logging.warning("Calibrating on noise, pass a directory of "
+                           "crops from facefit_batch -c")
+
+    if variant == 'fp16':
+        reduced = half_weights(graph_def)
+    else:
+        reduced = eight_bit(graph_def, crops)
+
+    expected = run(graph_def, crops)
+    result = run(reduced, crops)
+    diff = np.abs(result - expected)
+    # the position map is scaled by 256 * 1.1 into pixels of the crop
+    scale = RESOLUTION_IN * 1.1
+    tf.logging.info("Size: %d -> %d bytes", graph_def.ByteSize(),
+                    reduced.ByteSize())
+    tf.logging.info("Difference: mean %.3f px, max %.3f px",
+                    diff.mean() * scale, diff.max() * scale)
+
+    tf.logging.info("Saving %s graph...", variant)
+    tf.train.write_graph(reduced, '.', variant_path + '.tmp', as_text=False)
+    tf.gfile.Rename(variant_path + '.tmp', variant_path, overwrite=True)
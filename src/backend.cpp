@@ -0,0 +1,98 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "backend.h"
+#ifdef FACEFIT_HAVE_TENSORFLOW
+#include "tfbackend.h"
+#endif
+#ifdef FACEFIT_HAVE_ONNXRUNTIME
+#include "onnxbackend.h"
+#endif
+
+#include <iostream>
+
+
+static const char* kVariantNames[kNumModelVariants] = {
+	"meta", "float", "fp16", "int8"
+};
+static const char* kVariantSuffixes[kNumModelVariants] = {
+	".meta", "_frozen.pb", "_fp16.pb", "_int8.pb"
+};
+static const char* kBackendNames[kNumBackends] = {
+	"tensorflow", "onnx"
+};
+
+
+std::string modelVariantPath(const std::string& checkpointPath,
+						ModelVariant variant)
+{
+	return checkpointPath + kVariantSuffixes[variant];
+}
+
+
+const char* modelVariantName(ModelVariant variant)
+{
+	return kVariantNames[variant];
+}
+
+
+bool parseModelVariant(const std::string& name, ModelVariant& variant)
+{
+	for (int i = 0; i < kNumModelVariants; i++) {
+		if (name == kVariantNames[i]) {
+			variant = (ModelVariant)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+const char* backendName(BackendType backend)
+{
+	return kBackendNames[backend];
+}
+
+
+bool parseBackend(const std::string& name, BackendType& backend)
+{
+	for (int i = 0; i < kNumBackends; i++) {
+		if (name == kBackendNames[i]) {
+			backend = (BackendType)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+std::unique_ptr<InferenceBackend> createBackend(const ModelConfig& config)
+{
+	switch (config.backend) {
+#ifdef FACEFIT_HAVE_TENSORFLOW
+	case kTensorFlowBackend:
+		return TensorFlowBackend::load(config);
+#endif
+#ifdef FACEFIT_HAVE_ONNXRUNTIME
+	case kOnnxBackend:
+		return OnnxBackend::load(config);
+#endif
+	default:
+		std::cout << "FaceFit is built without the "
+			<< backendName(config.backend) << " backend.\n";
+		return nullptr;
+	}
+}
@@ -0,0 +1,104 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef BACKEND_H_
+#define BACKEND_H_
+
+#include "floattensor.h"
+#include <memory>
+#include <string>
+
+
+// The engines PRNet can run on, which of them are there depends on the
+// build, see FACEFIT_WITH_TENSORFLOW and FACEFIT_WITH_ONNXRUNTIME
+enum BackendType {
+	kTensorFlowBackend,	// the meta graph or the frozen graphs
+	kOnnxBackend,		// ONNX Runtime, lighter and CPU only
+	kNumBackends
+};
+
+#ifdef FACEFIT_HAVE_TENSORFLOW
+static const BackendType kDefaultBackend = kTensorFlowBackend;
+#else
+static const BackendType kDefaultBackend = kOnnxBackend;
+#endif
+
+// The graphs next to the checkpoint, freeze_graph.py writes the frozen
+// one, e.g. 256_256_resfcn256_weight_frozen.pb, with the weights folded
+// in, and quantize_graph.py the reduced precision ones made of it.
+// The ONNX backend has only <checkpoint>.onnx and <checkpoint>_int8.onnx
+// export_onnx.py writes, the others fall back to the float one.
+enum ModelVariant {
+	kMetaGraph,	// the meta graph and the checkpoint
+	kFrozen,	// <checkpoint>_frozen.pb
+	kHalf,		// <checkpoint>_fp16.pb, half weights cast on load
+	kInt8,		// <checkpoint>_int8.pb, eight bit encoder
+	kNumModelVariants
+};
+
+// What to load, chosen at load time, e.g. from the environment
+struct ModelConfig
+{
+	// the checkpoint's path without an extension, the models' paths
+	// are made of it
+	std::string checkpointPath;
+	ModelVariant variant;
+	BackendType backend;
+	// the cores all the sessions of the process may use together and
+	// how many sessions share them, 0 threads for the runtime's default
+	int threads;
+	int sharedSessions;
+
+	ModelConfig(const std::string& checkpointPath = "",
+			ModelVariant variant = kFrozen,
+			BackendType backend = kDefaultBackend) :
+		checkpointPath(checkpointPath),
+		variant(variant),
+		backend(backend),
+		threads(0),
+		sharedSessions(1) {}
+};
+
+// The graph's nodes, the exported models keep the names
+static const char* kInputName = "Placeholder";
+static const char* kOutputName = "resfcn256/Conv2d_transpose_16/Sigmoid";
+
+std::string modelVariantPath(const std::string& checkpointPath,
+						ModelVariant variant);
+const char* modelVariantName(ModelVariant variant);
+// "meta", "float", "fp16" or "int8", false if it's none of them
+bool parseModelVariant(const std::string& name, ModelVariant& variant);
+const char* backendName(BackendType backend);
+// "tensorflow" or "onnx", false if it's none of them
+bool parseBackend(const std::string& name, BackendType& backend);
+
+
+// An inference engine running the network on [n,H,W,3] crops
+class InferenceBackend {
+public:
+	virtual ~InferenceBackend() {}
+	// The position maps of the crops, an empty tensor if it's failed
+	virtual FloatTensor infer(const FloatTensor& input) = 0;
+	// the loaded one, it may have fallen back to another
+	virtual ModelVariant variant() const = 0;
+	virtual BackendType type() const = 0;
+};
+
+// Null if the backend isn't built or the model fails to load
+std::unique_ptr<InferenceBackend> createBackend(const ModelConfig& config);
+
+
+#endif // BACKEND_H_
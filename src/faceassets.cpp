@@ -0,0 +1,248 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "faceassets.h"
+#include "trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kMagic[4] = { 'F', 'F', 'S', 'D' };
+static const uint32_t kVersion = 1;
+
+struct AssetHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t resolution;
+	uint32_t numFaceIndices;
+	uint32_t numKptIndices;
+	uint32_t numTriIndices;
+	uint64_t reserved;
+};
+
+static_assert(sizeof(AssetHeader) == 32, "unexpected asset header size");
+static_assert(sizeof(Point3) == 3 * sizeof(float), "Point3 isn't packed");
+
+
+FaceAssets::~FaceAssets()
+{
+	unmap();
+}
+
+
+void FaceAssets::unmap()
+{
+	if (_map)
+		munmap(_map, _mapSize);
+	_map = nullptr;
+	_mapSize = 0;
+}
+
+
+// The files are doubles one per line, e.g. 1.285000000000000000e+03,
+// strtod on the whole file is a lot faster than ifstream >> double
+bool FaceAssets::readIndices(const std::string& path,
+					std::vector<int>& indices)
+{
+	FILE* f = std::fopen(path.c_str(), "rb");
+	if (!f) {
+		std::cout << "Error reading indices file.\n";
+		return false;
+	}
+	std::string text;
+	char buffer[1 << 16];
+	size_t n;
+	while ((n = std::fread(buffer, 1, sizeof(buffer), f)) > 0)
+		text.append(buffer, n);
+	std::fclose(f);
+
+	const char* p = text.c_str();
+	char* end;
+	while (true) {
+		double index = std::strtod(p, &end);
+		if (end == p)
+			break;
+		indices.push_back((int)index);
+		p = end;
+	}
+	return true;
+}
+
+
+bool FaceAssets::loadText(const std::string& trianglesPath,
+			const std::string& faceIndicesPath,
+			const std::string& kptIndicesPath,
+			int resolution,
+			const Progress& progress)
+{
+	TRACE_SCOPE("load text assets");
+	unmap();
+	_resolution = resolution;
+	bool ok = true;
+	auto report = [&](float fraction) {
+		if (progress)
+			progress(fraction);
+	};
+
+	_ownedFaceIndices.clear();
+	ok = readIndices(faceIndicesPath, _ownedFaceIndices) && ok;
+	report(0.25f);
+
+	std::vector<int> kptIndices2d;
+	ok = readIndices(kptIndicesPath, kptIndices2d) && ok;
+	int size = kptIndices2d.size() / 2;
+	_ownedKptIndices.clear();
+	for (int i = 0; i < size; i++) {
+		int x = kptIndices2d.at(i + size);
+		int y = kptIndices2d.at(i);
+		_ownedKptIndices.push_back(x * resolution + y);
+	}
+	report(0.5f);
+
+	_ownedTriIndices.clear();
+	ok = readIndices(trianglesPath, _ownedTriIndices) && ok;
+	report(0.75f);
+
+	int numPoints = resolution * resolution;
+	_ownedUVs.resize(numPoints);
+	_ownedDefaultPoints.resize(numPoints);
+
+	for (int i = 0; i < resolution; i++) {
+		for (int j = 0; j < resolution; j++) {
+			int i_flat = i * resolution + j;
+
+			_ownedDefaultPoints.at(i_flat).set(i * 2, j * 2, 0);
+
+			_ownedUVs[i_flat].set(
+				(float)j / (float)resolution,
+				1 - (float)i / (float)resolution,
+				0.0
+			);
+		}
+	}
+
+	_faceIndices = _ownedFaceIndices;
+	_kptIndices = _ownedKptIndices;
+	_triIndices = _ownedTriIndices;
+	_defaultPoints = _ownedDefaultPoints;
+	_uvs = _ownedUVs;
+	report(1.0f);
+	return ok;
+}
+
+
+bool FaceAssets::map(const std::string& path, int resolution)
+{
+	TRACE_SCOPE("map assets");
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(AssetHeader)) {
+		close(fd);
+		return false;
+	}
+
+	size_t size = st.st_size;
+	void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping stays valid after closing the descriptor
+	close(fd);
+	if (addr == MAP_FAILED)
+		return false;
+
+	auto header = (const AssetHeader*)addr;
+	size_t numPoints = (size_t)resolution * resolution;
+	size_t numIndices = (size_t)header->numFaceIndices +
+			header->numKptIndices + header->numTriIndices;
+	if (std::memcmp(header->magic, kMagic, 4) != 0 ||
+			header->version != kVersion ||
+			header->resolution != (uint32_t)resolution ||
+			size != sizeof(AssetHeader) +
+				numIndices * sizeof(int32_t) +
+				numPoints * 2 * sizeof(Point3)) {
+		munmap(addr, size);
+		return false;
+	}
+
+	unmap();
+	_map = addr;
+	_mapSize = size;
+	_resolution = resolution;
+
+	const int32_t* indices = (const int32_t*)(header + 1);
+	_faceIndices = IndexView(indices, header->numFaceIndices);
+	indices += header->numFaceIndices;
+	_kptIndices = IndexView(indices, header->numKptIndices);
+	indices += header->numKptIndices;
+	_triIndices = IndexView(indices, header->numTriIndices);
+	indices += header->numTriIndices;
+	const Point3* points = (const Point3*)indices;
+	_defaultPoints = ArrayView<Point3>(points, numPoints);
+	_uvs = ArrayView<Point3>(points + numPoints, numPoints);
+
+	_ownedFaceIndices.clear();
+	_ownedKptIndices.clear();
+	_ownedTriIndices.clear();
+	_ownedDefaultPoints.clear();
+	_ownedUVs.clear();
+	return true;
+}
+
+
+bool FaceAssets::write(const std::string& path) const
+{
+	// the file is renamed into place once it's complete,
+	// a process starting meanwhile never maps a partial one
+	std::string tmpPath = path + "." + std::to_string(getpid()) + ".tmp";
+	FILE* f = std::fopen(tmpPath.c_str(), "wb");
+	if (!f)
+		return false;
+
+	AssetHeader header;
+	std::memcpy(header.magic, kMagic, 4);
+	header.version = kVersion;
+	header.resolution = _resolution;
+	header.numFaceIndices = _faceIndices.size();
+	header.numKptIndices = _kptIndices.size();
+	header.numTriIndices = _triIndices.size();
+	header.reserved = 0;
+
+	auto put = [&](const void* data, size_t size, size_t count) {
+		return count == 0 || std::fwrite(data, size, count, f) == count;
+	};
+	bool ok = put(&header, sizeof(header), 1) &&
+		put(_faceIndices.data(), sizeof(int32_t), _faceIndices.size()) &&
+		put(_kptIndices.data(), sizeof(int32_t), _kptIndices.size()) &&
+		put(_triIndices.data(), sizeof(int32_t), _triIndices.size()) &&
+		put(_defaultPoints.data(), sizeof(Point3),
+					_defaultPoints.size()) &&
+		put(_uvs.data(), sizeof(Point3), _uvs.size());
+	ok = std::fclose(f) == 0 && ok;
+
+	if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,92 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef FACEASSETS_H_
+#define FACEASSETS_H_
+
+#include "imageview.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+// The index data of PRNet's position map, the default points and UVs.
+// They're either parsed from PRNet's text files or mapped read-only from
+// a binary asset facefit_assets makes of them, the pages of which are
+// shared by all the processes mapping the file.
+//
+// The asset layout is a 32 bytes header
+//   char[4] magic "FFSD", uint32 version, uint32 resolution,
+//   uint32 numFaceIndices, uint32 numKptIndices, uint32 numTriIndices,
+//   uint64 reserved
+// followed by int32 face indices, key point indices (already flattened
+// into the position map) and triangle indices, then resolution^2 float
+// xyz default points and as many UVs.
+// The asset's name in the uv-data directory
+static const char* const kStaticAssetName = "static_data.ffsd";
+
+class FaceAssets {
+public:
+	// the fraction loaded, reported after each file
+	typedef std::function<void(float fraction)> Progress;
+
+	FaceAssets() {}
+	~FaceAssets();
+	bool loadText(const std::string& trianglesPath,
+			const std::string& faceIndicesPath,
+			const std::string& kptIndicesPath,
+			int resolution,
+			const Progress& progress = nullptr);
+	// false if the file is missing, of another version or resolution
+	bool map(const std::string& path, int resolution);
+	bool write(const std::string& path) const;
+
+	bool mapped() const { return _map != nullptr; }
+	IndexView faceIndices() const { return _faceIndices; }
+	IndexView kptIndices() const { return _kptIndices; }
+	IndexView triIndices() const { return _triIndices; }
+	ArrayView<Point3> defaultPoints() const { return _defaultPoints; }
+	ArrayView<Point3> uvs() const { return _uvs; }
+
+private:
+	FaceAssets(const FaceAssets&) = delete;
+	FaceAssets& operator=(const FaceAssets&) = delete;
+
+	// the text files' data, the views point either here or into the map
+	std::vector<int> _ownedFaceIndices;
+	std::vector<int> _ownedKptIndices;
+	std::vector<int> _ownedTriIndices;
+	Point3List _ownedDefaultPoints;
+	Point3List _ownedUVs;
+
+	IndexView _faceIndices;
+	IndexView _kptIndices;
+	IndexView _triIndices;
+	ArrayView<Point3> _defaultPoints;
+	ArrayView<Point3> _uvs;
+	int _resolution = 0;
+
+	void* _map = nullptr;
+	size_t _mapSize = 0;
+
+	void unmap();
+	static bool readIndices(const std::string& path,
+					std::vector<int>& indices);
+};
+
+
+#endif // FACEASSETS_H_
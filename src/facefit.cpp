@@ -15,10 +15,18 @@
  * ************************************************************************/
 
 #include "facefit.h"
+#include "keyframes.h"
+#include "threadbudget.h"
+#include "trace.h"
 #include <DDImage/Knobs.h>
 #include <DDImage/Point.h>
 #include <DDImage/PolyMesh.h>
 #include <DDImage/Polygon.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <thread>
 
 using namespace DD::Image;
 using namespace facefit;
@@ -26,27 +34,214 @@ using namespace facefit;
 
 // Nuke can create several instances even for a single node,
 // it's better to load NN models and related data into static variables.
-Nuke2TensorFlow::StaticData Nuke2TensorFlow::data(
-			kDetectorModelPath, kTrianglesPath, kFaceIndicesPath,
-			kKptIndicesPath, kPRNetResolution);
-// Without thread_local TF, being statically initialised, steals the UI thread.
-// However, I suspect there're more elegant solutions for tackling this.
-thread_local PRNet FaceFitOp::_net = PRNet(kMetaGraphPath, kCheckpointPath);
+// They are loaded when the first node is created rather than with
+// the plug-in, so scripts without the node don't wait for them.
+LazyLoad<Nuke2TensorFlow::StaticData> FaceFitOp::_data(
+	[](std::atomic<float>& progress) {
+		auto start = std::chrono::steady_clock::now();
+		auto data = new Nuke2TensorFlow::StaticData(
+				kDetectorModelPath, kTrianglesPath,
+				kFaceIndicesPath, kKptIndicesPath,
+				kPRNetResolution, kStaticAssetPath, &progress);
+		std::cout << "Static data loaded in "
+			<< std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count()
+			<< " s\n";
+		return data;
+	});
+
+
+static int numSessions()
+{
+	const char* n = std::getenv(kSessionsEnv);
+	return n ? std::atoi(n) : kDefaultSessions;
+}
+
+static ModelConfig modelConfig()
+{
+	ModelConfig config(kCheckpointPath, kDefaultModelVariant);
+	const char* name = std::getenv(kModelEnv);
+	if (name && !parseModelVariant(name, config.variant))
+		std::cout << "Unknown " << kModelEnv << " " << name << "\n";
+	name = std::getenv(kBackendEnv);
+	if (name && !parseBackend(name, config.backend))
+		std::cout << "Unknown " << kBackendEnv << " " << name << "\n";
+	return config;
+}
+
+// Set before the pool and the host's stages start any threads,
+// anything but a count or count@core leaves the runtimes' defaults
+static bool threadBudgetSet = [] {
+	const char* text = std::getenv(kThreadsEnv);
+	ThreadBudget budget;
+	if (text && !budget.parse(text))
+		std::cout << "Unknown " << kThreadsEnv << " " << text << "\n";
+	setThreadBudget(budget);
+	return true;
+}();
+
+// TF being statically initialised steals the UI thread, the pool loads
+// the sessions on the first request on threads of its own
+InferencePool FaceFitOp::_pool(modelConfig(), numSessions());
+
+
+static size_t cacheMaxBytes()
+{
+	const char* mb = std::getenv(kCacheSizeEnv);
+	return (mb ? std::strtoull(mb, nullptr, 10) : kCacheSizeMB) << 20;
+}
+
+
+static size_t cacheMaxDiskBytes()
+{
+	const char* mb = std::getenv(kCacheDiskEnv);
+	return (mb ? std::strtoull(mb, nullptr, 10) : kCacheDiskMB) << 20;
+}
+
+
+static std::string cacheDir()
+{
+	const char* dir = std::getenv(kCacheDirEnv);
+	return dir ? dir : "";
+}
+
+// Inferred frames are shared by all the instances and nodes
+InferenceCache FaceFitOp::_cache(cacheMaxBytes(), cacheDir(),
+						cacheMaxDiskBytes());
+
+std::map<std::string, std::unique_ptr<SequenceWriter>> FaceFitOp::_writers;
+std::mutex FaceFitOp::_writersMutex;
+
+
+static_assert(sizeof(Vector3) == sizeof(Point3),
+		"Vector3 isn't layout compatible with Point3");
+
+
+// Views Nuke's bottom-up plane from top to bottom without copying,
+// the plane may be a region of a frame of the given height
+static ImageView planeView(const ImagePlane& plane, int frameHeight)
+{
+	const Box& bounds = plane.bounds();
+	ImageView view;
+	view.width = bounds.w();
+	view.height = bounds.h();
+	view.rowStride = -plane.rowStride();
+	view.colStride = plane.colStride();
+	view.chanStride = plane.chanStride();
+	view.data = plane.readable() + (bounds.h() - 1) * plane.rowStride();
+	view.left = bounds.x();
+	view.top = frameHeight - bounds.t();
+	view.frameHeight = frameHeight;
+	return view;
+}
+
+
+// A square region around a face box given in top-down coordinates,
+// it's returned in Nuke's coordinates clipped to the format
+static Box faceRegion(const dlib::rectangle& face, float scale,
+				const Format& format)
+{
+	int h = format.height();
+	float cx = (face.left() + face.right()) / 2.0f;
+	float cy = h - (face.top() + face.bottom()) / 2.0f;
+	float half = (face.width() + face.height()) / 4.0f * scale +
+							kRegionPadding;
+	Box box((int)(cx - half), (int)(cy - half),
+		(int)(cx + half) + 1, (int)(cy + half) + 1);
+	box.intersect(Box(0, 0, format.width(), h));
+	return box;
+}
+
+
+static void copyPoints(ArrayView<Point3> src, PointList& dst)
+{
+	trace::count(trace::kPointsCopied, src.size());
+	dst.resize(src.size());
+	std::copy(src.begin(), src.end(), (Point3*)dst.data());
+}
+
+
+static void gatherPoints(const Point3* src, IndexView indices,
+							PointList& dst)
+{
+	trace::count(trace::kPointsCopied, indices.size());
+	dst.resize(indices.size());
+	Point3* p = (Point3*)dst.data();
+	for (int index : indices)
+		*p++ = src[index];
+}
+
+
+// The layout's points of a whole map, e.g. of the default points
+static void layoutPoints(ArrayView<Point3> map, const PointLayout& layout,
+							PointList& dst)
+{
+	if (layout.indices.empty())
+		copyPoints(map, dst);
+	else
+		gatherPoints(map.data(), layout.indices, dst);
+}
 
 
 FaceFitOp::FaceFitOp(Node* node) :
 	SourceGeo(node),
 	_outType(0),
 	_faceDetector(true),
+	_detectorType(kHogDetector),
+	_minFaceSize(0),
+	_allFaces(false),
+	_trackFace(false),
+	_keyframes(false),
+	_keyInterval(kDefaultKeyInterval),
+	_maxMotion(kDefaultMaxMotion),
+	_lookAheadFrames(kDefaultLookAhead),
+	_useCache(true),
+	_sequencePath(""),
+	_sequenceMode(kSequenceOff),
+	_sequencePrecision(kDefaultSequencePrecision),
 	_cf{1, 0, 0},
 	_bBox{0, 0, 0, 0},
 	_updateReqInc(0),
 	_pointRadius(5.0f),
-	_n2tf(kPRNetResolution)
+	_n2tf(kPRNetResolution),
+	_faceIds(kFaceIdMinOverlap, kFaceIdMaxGap),
+	_aheadN2tf(kPRNetResolution)
 {
-	std::cout << "FaceFitOp constructor.\n";
 	_currentOutType = -1;
 	_currentPointRadius = -1;
+	std::fill(_currentCf, _currentCf + 3, -1.0f);
+	_cachedReqInc = 0;
+	_currentAllFaces = false;
+	_hasLastFace = false;
+	_readerSize = 0;
+
+	_data.start();
+	if (std::getenv(kWarmUpEnv)) {
+		_pool.load(kPRNetResolution);
+	}
+}
+
+
+// Waits for the static data showing the progress,
+// false if the user has cancelled it
+bool FaceFitOp::waitForData()
+{
+	if (!_data.ready()) {
+		progressMessage("Loading FaceFit data");
+		while (!_data.ready()) {
+			if (aborted())
+				return false;
+			progressFraction(_data.progress());
+			std::this_thread::sleep_for(
+					std::chrono::milliseconds(50));
+		}
+		progressFraction(1.0);
+	}
+	// the CNN detector is loaded on its first detection
+	if (_faceDetector && _detectorType == kCnnDetector &&
+					!data().cnnDetector.loaded())
+		progressMessage("Loading the CNN face detector");
+	return true;
 }
 
 
@@ -80,12 +275,61 @@ void FaceFitOp::knobs(Knob_Callback f)
 {
 	SourceGeo::knobs(f);
 	Bool_knob(f, &_faceDetector,"detect_face", "detect face");
+	Enumeration_knob(f, &_detectorType, _detectorNames, "detector",
+								"detector");
+	Tooltip(f, "HOG is quick, CNN also finds turned and partly covered "
+		"faces and is a lot slower without a GPU. Its model is loaded "
+		"when it's first used.");
+	Int_knob(f, &_minFaceSize, "min_face_size", "min face size");
+	SetRange(f, 0, 512);
+	Tooltip(f, "The smallest face to find in pixels, the frame is "
+		"detected on downscaled or upsampled so that such a face "
+		"fills the detector's window. 0 for a sixth of the frame's "
+		"height.");
+	Bool_knob(f, &_trackFace, "track_face", "track");
+	Tooltip(f, "Crops a frame around the face fitted in the neighbouring "
+		"frame and runs the detector only when the tracking is lost.");
+	Bool_knob(f, &_allFaces, "all_faces", "all faces");
+	Tooltip(f, "Fits every face the detector finds in a single batch, "
+		"each face is an object of its own with the face_id "
+		"attribute kept across frames. The tracking, the keyframes "
+		"and the look-ahead are of a single face.");
 	BBox_knob(f, _bBox, "bounding_box", "face bounds");
 	Enumeration_knob(f, &_outType, _outTypeNames, "out_type", "out");
 	Color_knob(f, _cf, "colour", "colour");
 	Float_knob(f, &_pointRadius, "point_radius", "point radius");
 	SetRange(f, 0.1, 4);
+	Bool_knob(f, &_keyframes, "keyframes", "keyframes");
+	Tooltip(f, "Infers every few frames and interpolates the rest, "
+		"frames between keyframes are inferred as well where the key "
+		"points move more than the max motion.");
+	Int_knob(f, &_keyInterval, "keyframe_interval", "interval");
+	SetRange(f, 2, 32);
+	Float_knob(f, &_maxMotion, "max_motion", "max motion");
+	SetRange(f, 0.0, 0.2);
+	Tooltip(f, "The largest key point displacement between keyframes "
+		"relative to the face's size.");
+	Int_knob(f, &_lookAheadFrames, "look_ahead", "look ahead");
+	SetRange(f, 0, 16);
+	Tooltip(f, "Frames fitted in the background in the direction of "
+		"playback, 0 disables it. It needs the cache.");
 	Button(f, "request_infer", "request infer");
+	Bool_knob(f, &_useCache, "use_cache", "use cache");
+	Button(f, "cache_stats", "cache stats");
+	File_knob(f, &_sequencePath, "sequence_file", "sequence file");
+	Enumeration_knob(f, &_sequenceMode, _sequenceModeNames, "sequence",
+								"sequence");
+	Tooltip(f, "Write appends each fitted frame to the file, a render "
+		"of the take fills it. Read plays the file back instead of "
+		"fitting, frames it hasn't got are fitted. The file is of "
+		"the output mode's points, the key points are read from a "
+		"file of the face's points too. An existing file of other "
+		"points or precision is never overwritten.");
+	Enumeration_knob(f, &_sequencePrecision, _precisionNames,
+				"sequence_precision", "precision");
+	Tooltip(f, "How the written points are stored. Half is half the "
+		"size of float and within 1/2000 of the face's size, int16 "
+		"as much and within 1/130000 of it.");
 }
 
 
@@ -93,12 +337,56 @@ int FaceFitOp::knob_changed(Knob* k)
 {
 	if (k == &Knob::showPanel) {
 		knob("bounding_box")->enable(!_faceDetector);
+		knob("track_face")->enable(_faceDetector);
+		knob("all_faces")->enable(_faceDetector);
+		knob("detector")->enable(_faceDetector);
+		knob("min_face_size")->enable(_faceDetector);
 		knob("point_radius")->enable(_outType != kMesh);
+		knob("keyframe_interval")->enable(_keyframes);
+		knob("max_motion")->enable(_keyframes);
+		knob("sequence_precision")->enable(
+					_sequenceMode == kSequenceWrite);
+		return 1;
+	}
+
+	if (k->is("sequence"))  {
+		knob("sequence_precision")->enable(
+					_sequenceMode == kSequenceWrite);
+		return 1;
+	}
+
+	if (k->is("keyframes"))  {
+		knob("keyframe_interval")->enable(_keyframes);
+		knob("max_motion")->enable(_keyframes);
 		return 1;
 	}
 
 	if (k->is("detect_face"))  {
 		knob("bounding_box")->enable(!_faceDetector);
+		knob("track_face")->enable(_faceDetector);
+		knob("all_faces")->enable(_faceDetector);
+		knob("detector")->enable(_faceDetector);
+		knob("min_face_size")->enable(_faceDetector);
+		_tracked.clear();
+		faceIds().clear();
+		if (_lookAhead)
+			_lookAhead->cancel();
+		return 1;
+	}
+
+	if (k->is("bounding_box") || k->is("look_ahead") ||
+			k->is("detector") || k->is("min_face_size")) {
+		if (_lookAhead)
+			_lookAhead->cancel();
+	}
+
+	// the faces found with other settings don't match the new ones
+	if (k->is("detector") || k->is("min_face_size"))
+		faceIds().clear();
+
+	if (k->is("track_face"))  {
+		_tracked.clear();
+		faceIds().clear();
 		return 1;
 	}
 
@@ -108,200 +396,856 @@ int FaceFitOp::knob_changed(Knob* k)
 	}
 
 	if (k->is("request_infer"))  {
-		std::cout << "Update requested.\n";
 		_updateReqInc++;
 		invalidateSameHash();
 		return 1;
 	}
+
+	if (k->is("cache_stats"))  {
+		std::cout << "Inference cache: " << _cache.hits() << " hits ("
+			<< _cache.diskHits() << " from disk), "
+			<< _cache.misses() << " misses, "
+			<< (_cache.bytes() >> 20) << " MB in memory.\n";
+		std::cout << "Inferences: "
+			<< trace::counterValue(trace::kInferences)
+			<< ", " << trace::counterValue(trace::kFailedInferences)
+			<< " failed, "
+			<< trace::counterValue(trace::kDetectorMisses)
+			<< " frames without a face.\n";
+		std::cout << "Tracking: "
+			<< trace::counterValue(trace::kDetectorSkips)
+			<< " detector calls saved, "
+			<< trace::counterValue(trace::kTrackLosses)
+			<< " times lost.\n";
+		std::cout << "Look-ahead: "
+			<< trace::counterValue(trace::kLookAheadFitted)
+			<< " frames fitted, "
+			<< trace::counterValue(trace::kLookAheadCancelled)
+			<< " cancelled.\n";
+		std::cout << "Sessions: " << _pool.size() << " of the "
+			<< modelVariantName(_pool.config().variant)
+			<< " model on " << backendName(_pool.config().backend)
+			<< ", loaded in "
+			<< _pool.loadSeconds() << " s, "
+			<< (_pool.loadBytes() >> 20) << " MB.\n";
+		std::cout << "Threads: " << threadBudget().str() << "\n";
+		std::cout << "CNN detector: "
+			<< (data().cnnDetector.loaded() ? "loaded" :
+							"not loaded")
+			<< ".\n";
+		std::cout << "Points copied: "
+			<< trace::counterValue(trace::kPointsCopied)
+			<< ", besides the extraction.\n";
+		std::cout << "Shared topology: "
+			<< ((data().meshTopology().bytes() +
+				data().cloudTopology().bytes() +
+				data().kptTopology().bytes()) >> 10)
+			<< " KB.\n";
+		return 1;
+	}
 	return SourceGeo::knob_changed(k);
 }
 
 
-void FaceFitOp::infer(bool modify)
+ChannelSet FaceFitOp::channels()
+{
+	Channel channelMask[3] = { Chan_Red, Chan_Green, Chan_Blue };
+	return ChannelSet(channelMask, 3);
+}
+
+
+ImageView FaceFitOp::fetch(Iop* input, ImagePlane& plane)
+{
+	TRACE_SCOPE("fetchPlane");
+	const Box& box = plane.bounds();
+	input->request(box, channels(), 0);
+	input->fetchPlane(plane);
+	trace::count(trace::kBytesFetched,
+		(int64_t)box.w() * box.h() * 3 * sizeof(float));
+	return planeView(plane, input->format().height());
+}
+
+
+// The input at another frame of the same context, for keyframes
+Iop* FaceFitOp::inputAt(int frame)
+{
+	OutputContext context = outputContext();
+	context.setFrame(frame);
+	Iop* input = dynamic_cast<Iop*>(node_input(0, OUTPUT_OP, &context));
+	if (!input)
+		return nullptr;
+	input->validate(true);
+	return input;
+}
+
+
+Hash FaceFitOp::inferenceKey(Iop* input, bool keyPoints)
 {
-	auto defaultPoints = Nuke2TensorFlow::data.defaultPoints();
+	// everything the inferred points depend on
+	Hash key;
+	key.append(input->hash());
+	key.append((int)_faceDetector);
+	if (_faceDetector) {
+		key.append(_detectorType);
+		key.append(_minFaceSize);
+		// the tracked crop fits slightly different points
+		key.append((int)_trackFace);
+	} else {
+		for (int i = 0; i < 4; i++)
+			key.append(_bBox[i]);
+	}
+	key.append(kPRNetResolution);
+	// the reduced precision variants and the other backends infer
+	// slightly different points
+	key.append((int)_pool.config().variant);
+	key.append((int)_pool.config().backend);
+	// only the key points or the face's points are extracted
+	key.append((int)keyPoints);
+	// all the faces' points one after another
+	key.append((int)allFaces());
+	return key;
+}
+
 
-	if (!modify) {
-		_bufferPoints.resize(defaultPoints.size());
-		std::copy(defaultPoints.begin(),
-			defaultPoints.end(), _bufferPoints.begin());
+DetectorConfig FaceFitOp::detectorConfig() const
+{
+	DetectorConfig config;
+	config.type = (DetectorType)_detectorType;
+	config.minFaceSize = _minFaceSize;
+	return config;
+}
+
+
+const PointLayout& FaceFitOp::layout() const
+{
+	return _outType == kKeyPoints ? data().kptLayout() :
+					data().faceLayout();
+}
+
+
+// The neighbour in either direction so as to playing backwards tracked too
+const FaceFitOp::TrackedFace* FaceFitOp::trackedNeighbour(int frame) const
+{
+	for (int neighbour : { frame - 1, frame + 1 }) {
+		auto it = _tracked.find(neighbour);
+		if (it != _tracked.end())
+			return &it->second;
 	}
+	return nullptr;
+}
+
+
+void FaceFitOp::setTracked(int frame, const TrackedFace& tracked)
+{
+	_tracked[frame] = tracked;
+	_tracked.erase(_tracked.begin(),
+			_tracked.lower_bound(frame - kTrackKeptFrames));
+	_tracked.erase(_tracked.upper_bound(frame + kTrackKeptFrames),
+			_tracked.end());
+}
+
+
+// The points are extracted straight into the destination
+bool FaceFitOp::fit(const FloatTensor& input, PointList& points)
+{
+	auto output = _pool.infer(input);
+	if (output.dims() != 4)
+		return false;
+
+	points.resize(layout().size(kPRNetResolution));
+	_n2tf.extractDataFromTensor(output, _n2tf.crop(), layout(),
+						(Point3*)points.data());
+	return true;
+}
+
+
+bool FaceFitOp::infer(PointList& points)
+{
+	TRACE_SCOPE("infer");
+	const auto& defaultPoints = data().defaultPoints();
+
+	// the points there stay if the fitting fails, unless they're of
+	// another output mode or there are none yet
+	if (points.size() != layout().size(kPRNetResolution))
+		layoutPoints(defaultPoints, layout(), points);
+
+	// a played back frame needs neither the input nor the model
+	int frame = (int)outputContext().frame();
+	const SequenceReader* reader = sequenceReader();
+	if (reader && reader->numFaces(frame) > 0 &&
+			readSequenceFace(*reader, frame, 0, points))
+		return true;
 
 	if (input_iop() == default_input(0)->iop())
-		return;
+		return false;
+	_n2tf.setDetector(detectorConfig(), &data().cnnDetector);
+
+	// an explicit request bypasses the lookup and refreshes the entry
+	bool forced = _cachedReqInc != _updateReqInc;
+	_cachedReqInc = _updateReqInc;
+
+	if (_keyframes && _keyInterval > 1 && !forced) {
+		// keyframes always go through the cache, they're requested
+		// again for each frame in between, the buffer is only
+		// needed here
+		auto inferKeyframe = [&](int f, Point3List& keyPoints) {
+			Iop* input = f == frame ? input_iop() : inputAt(f);
+			if (!input || !inferFrame(input, f, false, true,
+							_bufferPoints))
+				return false;
+			const Point3* p = (const Point3*)_bufferPoints.data();
+			keyPoints.assign(p, p + _bufferPoints.size());
+			return true;
+		};
+		Point3List interpolated;
+		if (interpolateFrame(frame, _keyInterval, _maxMotion,
+				layout().kptIndices,
+				inferKeyframe, interpolated)) {
+			copyPoints(interpolated, points);
+			return true;
+		}
+		layoutPoints(defaultPoints, layout(), points);
+	}
 
-	Iop *inputIop = input_iop();
+	// frames ahead are fitted into the cache in the background,
+	// if this one is on its way it's waited for
+	if (_lookAheadFrames > 0 && _useCache && !forced) {
+		lookAhead().seek(frame, _lookAheadFrames);
+		lookAhead().wait(frame);
+	}
 
-	Format format = inputIop->format();
-	Box iopBox(0, 0, format.width(), format.height());
+	return inferFrame(input_iop(), frame, forced, _useCache, points);
+}
 
-	Channel channelMask[3] = { Chan_Red, Chan_Green, Chan_Blue };
-	auto channels = ChannelSet(channelMask, 3);
 
-	input_iop()->request(iopBox, channels, 0);
-	ImagePlane iopPlane = ImagePlane(iopBox, false, channels);
-	input_iop()->fetchPlane(iopPlane);
-	Box bBox(_bBox[0], _bBox[1], _bBox[2], _bBox[3]);
+bool FaceFitOp::inferFrame(Iop* input, int frame, bool forced,
+					bool useCache, PointList& points)
+{
+	const auto& defaultPoints = data().defaultPoints();
+	const Format& format = input->format();
+	int h = format.height();
+	bool tracking = _faceDetector && _trackFace;
+
+	bool keyPoints = _outType == kKeyPoints;
+	uint64_t key = inferenceKey(input, keyPoints).value();
+	if (useCache && !forced) {
+		// the face's points fitted in the other modes have the key
+		// points too, switching to them needn't infer again
+		const PointLayout* cachedLayout = &layout();
+		uint64_t cachedKey = key;
+		uint64_t faceKey = inferenceKey(input, false).value();
+		if (keyPoints && !_cache.contains(key) &&
+					_cache.contains(faceKey)) {
+			cachedKey = faceKey;
+			cachedLayout = &data().faceLayout();
+		}
+		auto cached = _cache.get(cachedKey);
+		if (cached && cached->size() ==
+				cachedLayout->size(kPRNetResolution)) {
+			const Point3* p = (const Point3*)cached->data();
+			if (cachedLayout == &layout())
+				copyPoints(ArrayView<Point3>(p, cached->size()),
+							points);
+			else
+				gatherPoints(p, cachedLayout->kptIndices,
+							points);
+			if (tracking) {
+				setTracked(frame, { Nuke2TensorFlow::keyPointsBox(
+					(const Point3*)points.data(),
+					layout().kptIndices, h), 0 });
+			}
+			return true;
+		}
+	}
 
-	tensorflow::Tensor input = _n2tf.imagePlane2Tensor(
-					iopPlane, bBox, _faceDetector);
-	if (input.dims() != 4) {
-		std::cout << "Couldn't process input image.\n";
-		return;
+	// a neighbour's key points give the crop, the fitted key points
+	// should land roughly where they were expected
+	const TrackedFace* prev = tracking ? trackedNeighbour(frame) : nullptr;
+	if (prev && prev->run < kTrackRedetectInterval) {
+		TrackedFace tracked = *prev;
+		ImagePlane trackPlane(faceRegion(tracked.face,
+				kTrackRegionScale, format), false, channels());
+		FloatTensor tensor = _n2tf.trackedPlane2Tensor(
+					fetch(input, trackPlane), tracked.face);
+		if (fit(tensor, points)) {
+			dlib::rectangle face = Nuke2TensorFlow::keyPointsBox(
+				(const Point3*)points.data(),
+				layout().kptIndices, h);
+			double overlap = dlib::box_intersection_over_union(
+							face, tracked.face);
+			if (overlap >= kTrackMinOverlap) {
+				trace::count(trace::kDetectorSkips);
+				setTracked(frame, { face, tracked.run + 1 });
+				_lastFace = face;
+				_hasLastFace = true;
+				if (useCache)
+					_cache.put(key,
+					    (const float*)points.data(),
+					    points.size());
+				return true;
+			}
+		}
+		trace::count(trace::kTrackLosses);
 	}
 
-	auto output = _net.infer(input);
-	if (output.dims() != 4) {
-		std::cout << "Couldn't process output tensor.\n";
-		return;
+	Box frameBox(0, 0, format.width(), format.height());
+	// the bounding box in top-down image coordinates
+	dlib::rectangle bBox(_bBox[0], h - _bBox[3], _bBox[2], h - _bBox[1]);
+
+	// Only a region around the face is fetched and converted, the user's
+	// box or the face found in the previous inference. Detection falls
+	// back to the whole frame if the face has left the region.
+	Box region = frameBox;
+	if (!_faceDetector)
+		region = faceRegion(bBox, 1.0f, format);
+	else if (_hasLastFace)
+		region = faceRegion(_lastFace, kTrackRegionScale, format);
+	bool wholeFrame = !_faceDetector || !_hasLastFace;
+
+	ImagePlane iopPlane(region, false, channels());
+	FloatTensor tensor = _n2tf.imagePlane2Tensor(
+				fetch(input, iopPlane), bBox, _faceDetector);
+	if (tensor.dims() != 4 && !wholeFrame) {
+		ImagePlane framePlane(frameBox, false, channels());
+		tensor = _n2tf.imagePlane2Tensor(
+				fetch(input, framePlane), bBox, _faceDetector);
 	}
-	
-	//std::cout << "Extracting inferred data...\n";
-	_n2tf.extractDataFromTensor(output);
-	_bufferPoints.resize(defaultPoints.size());
-	std::move(_n2tf.points().begin(), _n2tf.points().end(),
-			_bufferPoints.begin());
+	if (tensor.dims() != 4) {
+		_hasLastFace = false;
+		// the points the tracking has lost the face with are no good
+		if (prev)
+			layoutPoints(defaultPoints, layout(), points);
+		return false;
+	}
+	_lastFace = _n2tf.crop().face;
+	_hasLastFace = _faceDetector;
+
+	if (!fit(tensor, points))
+		return false;
+
+	if (tracking) {
+		setTracked(frame, { Nuke2TensorFlow::keyPointsBox(
+				(const Point3*)points.data(),
+				layout().kptIndices, h), 0 });
+	}
+
+	if (useCache)
+		_cache.put(key, (const float*)points.data(),
+				points.size());
+	return true;
 }
 
 
-void FaceFitOp::recreate_primitives(int obj, GeometryList& out,
-				const std::vector<int>& indices) 
+// Nuke makes several instances of a node, e.g. for the viewer and for
+// rendering, they should agree on the faces' IDs
+FaceIds& FaceFitOp::faceIds()
 {
-	out.delete_objects();
-	out.add_object(obj);
-	
-	if (_outType == kMesh) {
-		auto tris = Nuke2TensorFlow::data.triIndices();
-		auto f2a = Nuke2TensorFlow::data.face2all();
+	FaceFitOp* first = static_cast<FaceFitOp*>(firstOp());
+	return first ? first->_faceIds : _faceIds;
+}
 
-		auto mesh = new PolyMesh(tris.size(), tris.size() / 3);
-		for(int i = 2; i < tris.size(); i += 3) {
-			int corners[3] = {
-				f2a[tris[i]],
-				f2a[tris[i - 1]],
-				f2a[tris[i - 2]]
-			};
-			mesh->add_face(3, corners);
+
+// Every face the detector finds is fitted in a single batch, the frame is
+// converted and detected on once. The faces are cached one after another,
+// the IDs are given after the fitting or the lookup, from the key points'
+// boxes, and the faces are returned in the order of their IDs.
+bool FaceFitOp::inferFaces(std::vector<PointList>& faces,
+					std::vector<int>& ids)
+{
+	TRACE_SCOPE("infer faces");
+	faces.clear();
+	ids.clear();
+
+	// the file has the faces in the order of their IDs already
+	int frame = (int)outputContext().frame();
+	const SequenceReader* reader = sequenceReader();
+	int numRead = reader ? reader->numFaces(frame) : -1;
+	if (numRead >= 0) {
+		faces.resize(numRead);
+		for (int f = 0; f < numRead; f++) {
+			readSequenceFace(*reader, frame, f, faces[f]);
+			ids.push_back(reader->faceId(frame, f));
 		}
-		out.add_primitive(obj, mesh);
+		return true;
+	}
 
+	Iop* input = input_iop();
+	if (input == default_input(0)->iop())
+		return false;
+	_n2tf.setDetector(detectorConfig(), &data().cnnDetector);
+
+	bool forced = _cachedReqInc != _updateReqInc;
+	_cachedReqInc = _updateReqInc;
+
+	size_t faceSize = layout().size(kPRNetResolution);
+	uint64_t key = inferenceKey(input, _outType == kKeyPoints).value();
+	std::shared_ptr<const CachedPoints> cached;
+	if (_useCache && !forced)
+		cached = _cache.get(key);
+
+	const Format& format = input->format();
+	Point3List fitted;
+	const Point3* all;
+	size_t numFaces;
+	if (cached && cached->size() % faceSize == 0) {
+		all = (const Point3*)cached->data();
+		numFaces = cached->size() / faceSize;
 	} else {
-		auto endList = Nuke2TensorFlow::data.endList();
-		int start;
-		for (int i = 0; i < indices.size(); i++) {
-			int index = indices[i];
-
-			out.add_primitive(obj,
-				new Point(Point::RenderMode::DISC,
-						_pointRadius, index)
-			);
-
-			if (_outType == kPointCloud)
-				continue;
-
-			if (endList.find(i) != endList.end()) {
-				// shapes starting from 41 are closed
-				if (i >= 41) {
-					out.add_primitive(obj,
-						new Polygon(index, start, false)
-					);
-				}
-				start = indices[i + 1];
-				continue;
-			}
+		ImagePlane plane(Box(0, 0, format.width(), format.height()),
+							false, channels());
+		ImageView view = fetch(input, plane);
+		if (aborted())
+			return false;
+
+		// no tensor is the detector finding no face, a failed
+		// inference isn't an answer and isn't cached
+		FloatTensor tensor = _n2tf.facesPlane2Tensor(view, kMaxFaces);
+		FloatTensor output;
+		if (tensor.dims() == 4) {
+			output = _pool.infer(tensor);
+			if (output.dims() != 4)
+				return false;
+		}
+		numFaces = output.dims() == 4 ? output.dimSize(0) : 0;
 
-			out.add_primitive(obj,
-				new Polygon(index, indices[i + 1], false)
-			);
+		fitted.resize(numFaces * faceSize);
+		for (size_t i = 0; i < numFaces; i++) {
+			_n2tf.extractDataFromTensor(output,
+					_n2tf.batchCrops()[i], layout(),
+					&fitted[i * faceSize], i);
 		}
-		_currentPointRadius = _pointRadius;
+		all = fitted.data();
+		// a frame the detector has found no face in too, finding it
+		// out is as slow
+		if (_useCache)
+			_cache.put(key, (const float*)all, fitted.size());
 	}
-	_currentOutType = _outType;
+
+	std::vector<dlib::rectangle> boxes;
+	for (size_t i = 0; i < numFaces; i++) {
+		boxes.push_back(Nuke2TensorFlow::keyPointsBox(
+				all + i * faceSize, layout().kptIndices,
+				format.height()));
+	}
+	// another input is caught here, the knobs in knob_changed() too
+	Hash context;
+	context.append(input->node_name().c_str());
+	context.append(_detectorType);
+	context.append(_minFaceSize);
+	this->faceIds().setContext(context.value());
+	std::vector<int> faceIds = this->faceIds().identify(frame, boxes);
+
+	std::vector<size_t> order(numFaces);
+	for (size_t i = 0; i < numFaces; i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return faceIds[a] < faceIds[b];
+	});
+	faces.resize(numFaces);
+	for (size_t k = 0; k < numFaces; k++) {
+		size_t i = order[k];
+		copyPoints(ArrayView<Point3>(all + i * faceSize, faceSize),
+								faces[k]);
+		ids.push_back(faceIds[i]);
+	}
+	return true;
 }
 
 
-void FaceFitOp::create_geometry(Scene& scene, GeometryList& out)
+SequenceLayout FaceFitOp::sequenceLayout() const
 {
-	auto indices = _outType != kKeyPoints ?
-					Nuke2TensorFlow::data.faceIndices() :
-					Nuke2TensorFlow::data.kptIndices();
-	int obj = 0;
+	SequenceLayout sequence;
+	sequence.resolution = kPRNetResolution;
+	const PointLayout& points = layout();
+	sequence.indices.assign(points.indices.begin(),
+					points.indices.end());
+	sequence.kptIndices.assign(points.kptIndices.begin(),
+					points.kptIndices.end());
+	sequence.triangles = topology().triangles;
+	sequence.lines = topology().lines;
+	return sequence;
+}
+
 
-	if (rebuild(Mask_Primitives)) {
-		recreate_primitives(obj, out, indices);
+// The file is opened again when the output mode or the precision change,
+// an existing take of other points or precision is never overwritten,
+// nothing is written until the knobs match it or the path changes
+SequenceWriter* FaceFitOp::sequenceWriter()
+{
+	if (_sequenceMode != kSequenceWrite || !_sequencePath ||
+						!*_sequencePath)
+		return nullptr;
+	std::lock_guard<std::mutex> lock(_writersMutex);
+	auto& writer = _writers[_sequencePath];
+	PointEncoding encoding = (PointEncoding)_sequencePrecision;
+	// a failed open is reported once, not on every frame
+	if (writer && writer->numPoints() == layout().size(kPRNetResolution) &&
+					writer->encoding() == encoding)
+		return writer->isOpen() ? writer.get() : nullptr;
+	if (!writer)
+		writer.reset(new SequenceWriter);
+	if (!writer->open(_sequencePath, sequenceLayout(), encoding)) {
+		std::cout << "Couldn't write " << _sequencePath << ", it's "
+			"not writable or a sequence of other points or "
+			"precision, which is kept.\n";
+		return nullptr;
 	}
+	return writer.get();
+}
 
-	if (rebuild(Mask_Points)) {
-		PointList* points = out.writable_points(obj);
-		infer(points->size() > 0);
-		points->resize(_bufferPoints.size());
-		std::copy(_bufferPoints.begin(), _bufferPoints.end(),
-				points->begin());
+
+// A frame written already is kept unless it's been fitted again on request
+void FaceFitOp::writeSequence(int frame, bool forced,
+			const std::vector<int>& ids,
+			const std::vector<const Point3*>& faces)
+{
+	SequenceWriter* writer = sequenceWriter();
+	if (!writer || (writer->contains(frame) && !forced))
+		return;
+	if (!writer->write(frame, ids, faces))
+		std::cout << "Couldn't write frame " << frame << " to "
+			<< _sequencePath << ".\n";
+}
+
+
+// The file is mapped again once it has grown, e.g. while a render
+// writes it, the frames it hasn't got yet are fitted meanwhile
+const SequenceReader* FaceFitOp::sequenceReader()
+{
+	if (_sequenceMode != kSequenceRead || !_sequencePath ||
+						!*_sequencePath)
+		return nullptr;
+	struct stat st;
+	size_t size = stat(_sequencePath, &st) == 0 ? st.st_size : 0;
+	if (_readerPath != _sequencePath || _readerSize != size) {
+		_readerPath = _sequencePath;
+		_readerSize = size;
+		if (!_sequenceReader.open(_sequencePath))
+			std::cout << "Couldn't read " << _sequencePath
+				<< ".\n";
 	}
+	if (!_sequenceReader.isOpen() ||
+			_sequenceReader.resolution() != kPRNetResolution)
+		return nullptr;
+
+	size_t numPoints = layout().size(kPRNetResolution);
+	if (_sequenceReader.numPoints() == numPoints ||
+			(_outType == kKeyPoints &&
+			_sequenceReader.kptIndices().size() == numPoints))
+		return &_sequenceReader;
+	return nullptr;
+}
 
-	if (rebuild(Mask_Attributes)) {
-		auto objInfo = out.object(obj);
-		PointList* points = out.writable_points(obj);
 
-		if (_currentOutType != _outType) {
-			// save points from current obj before deleting
-			_bufferPoints.resize(
-				Nuke2TensorFlow::data.defaultPoints().size()
-			);
-			std::move(points->begin(), points->end(),
-					_bufferPoints.begin());
+// The key points are gathered from a file of the face's points
+bool FaceFitOp::readSequenceFace(const SequenceReader& reader, int frame,
+				int face, PointList& points) const
+{
+	size_t numPoints = layout().size(kPRNetResolution);
+	points.resize(numPoints);
+	if (reader.numPoints() == numPoints)
+		return reader.read(frame, face, (Point3*)points.data());
+	trace::count(trace::kPointsCopied, numPoints);
+	return reader.read(frame, face, reader.kptIndices(),
+						(Point3*)points.data());
+}
 
-			recreate_primitives(obj, out, indices);
-			// restore collected points
-			points = out.writable_points(obj);
-			points->resize(_bufferPoints.size());
-			std::move(_bufferPoints.begin(), _bufferPoints.end(),
-					points->begin());
 
-			objInfo = out.object(obj);
-		}
+// A frame fitted ahead of the playhead. The knobs are copied when the job
+// is made, the stages don't touch the op's state.
+struct FitJob : LookAheadJob
+{
+	uint64_t key;
+	bool detector;
+	DetectorConfig detectorConfig;
+	dlib::rectangle bBox;
+	std::unique_ptr<ImagePlane> plane;
+	ImageView view;
+	FloatTensor tensor;
+	FaceCrop crop;
+	PointLayout layout;
+};
+
+
+LookAhead& FaceFitOp::lookAhead()
+{
+	if (!_lookAhead) {
+		_lookAhead.reset(new LookAhead(
+			[this](int frame) { return createFitJob(frame); },
+			{
+				[this](LookAheadJob& job) {
+					return warpStage(job);
+				},
+				[this](LookAheadJob& job) {
+					return inferStage(job);
+				},
+			}));
+	}
+	return *_lookAhead;
+}
 
-		if (_outType != kMesh && _currentPointRadius != _pointRadius) {
-			for (int i = 0; i < objInfo.primitives(); i++) {
-				auto prim = objInfo.primitive(i);
-				// casts away constness, may be not legit
-				if (std::strcmp(prim->Class(), "Point") == 0)
-					((Point*)prim)->radius(_pointRadius);
-			}
-			_currentPointRadius = _pointRadius;
+
+// Nuke may delete the input's ops whenever it rebuilds the tree and
+// request() belongs to the thread which built it, so the region is fetched
+// synchronously here on the calling thread into the job's own plane, one
+// frame per seek. The stages never touch an op, only the plane. A frame
+// cached already is turned down before anything is fetched.
+LookAheadJobPtr FaceFitOp::createFitJob(int frame)
+{
+	Iop* input = inputAt(frame);
+	if (!input || input == default_input(0)->iop())
+		return nullptr;
+
+	auto job = std::make_shared<FitJob>();
+	bool keyPoints = _outType == kKeyPoints;
+	job->key = inferenceKey(input, keyPoints).value();
+	if (_cache.contains(job->key) || (keyPoints &&
+			_cache.contains(inferenceKey(input, false).value())))
+		return nullptr;
+
+	const Format& format = input->format();
+	int h = format.height();
+	job->detector = _faceDetector;
+	job->detectorConfig = detectorConfig();
+	job->bBox = dlib::rectangle(_bBox[0], h - _bBox[3],
+					_bBox[2], h - _bBox[1]);
+	Box region(0, 0, format.width(), h);
+	if (!_faceDetector)
+		region = faceRegion(job->bBox, 1.0f, format);
+	else if (_hasLastFace)
+		region = faceRegion(_lastFace, kTrackRegionScale, format);
+	job->layout = layout();
+
+	job->plane.reset(new ImagePlane(region, false, channels()));
+	job->view = fetch(input, *job->plane);
+	return job;
+}
+
+
+bool FaceFitOp::warpStage(LookAheadJob& base)
+{
+	FitJob& job = static_cast<FitJob&>(base);
+	_aheadN2tf.setDetector(job.detectorConfig, &data().cnnDetector);
+	// a face which has left the region is left to the playhead, it
+	// detects on the whole frame
+	job.tensor = _aheadN2tf.imagePlane2Tensor(job.view, job.bBox,
+							job.detector);
+	job.crop = _aheadN2tf.crop();
+	job.plane.reset();
+	return job.tensor.dims() == 4;
+}
+
+
+// The extraction doesn't touch _aheadN2tf's state the warp stage uses,
+// the frame shares the pool's batches with the other nodes' requests
+bool FaceFitOp::inferStage(LookAheadJob& base)
+{
+	FitJob& job = static_cast<FitJob&>(base);
+	auto output = _pool.infer(job.tensor);
+	if (output.dims() != 4)
+		return false;
+	Point3List points;
+	_aheadN2tf.extractDataFromTensor(output, job.crop, points,
+							job.layout.indices);
+	_cache.put(job.key, (const float*)points.data(), points.size());
+	return true;
+}
+
+
+const Topology& FaceFitOp::topology() const
+{
+	switch (_outType) {
+	case kMesh:
+		return data().meshTopology();
+	case kPointCloud:
+		return data().cloudTopology();
+	default:
+		return data().kptTopology();
+	}
+}
+
+
+// The primitives index the layout's points, not the whole map's, the
+// topology is shared by all the ops
+void FaceFitOp::recreate_primitives(int obj, GeometryList& out)
+{
+	TRACE_SCOPE("recreate_primitives");
+	out.add_object(obj);
+
+	const Topology& topo = topology();
+	const std::vector<int>& tris = topo.triangles;
+	if (!tris.empty()) {
+		auto mesh = new PolyMesh(tris.size(), tris.size() / 3);
+		for (size_t i = 0; i < tris.size(); i += 3) {
+			int corners[3] = { tris[i], tris[i + 1], tris[i + 2] };
+			mesh->add_face(3, corners);
 		}
+		out.add_primitive(obj, mesh);
+	}
+
+	for (int index : topo.points) {
+		out.add_primitive(obj,
+			new Point(Point::RenderMode::DISC, _pointRadius, index)
+		);
+	}
+	for (size_t i = 0; i < topo.lines.size(); i += 2) {
+		out.add_primitive(obj,
+			new Polygon(topo.lines[i], topo.lines[i + 1], false)
+		);
+	}
+	if (!topo.points.empty())
+		_currentPointRadius = _pointRadius;
+	_currentOutType = _outType;
+}
 
 
-		Attribute* ca = out.writable_attribute(obj, Group_Points,
-							"Cf", VECTOR4_ATTRIB);
+// The points' radius, colour and UVs of an object, an attribute made
+// writable is copied, only the stale ones are touched. The current values
+// are updated by the caller once all the objects are done.
+void FaceFitOp::update_attributes(int obj, GeometryList& out, bool relayout)
+{
+	auto objInfo = out.object(obj);
+
+	if (_outType != kMesh && _currentPointRadius != _pointRadius) {
+		for (int i = 0; i < objInfo.primitives(); i++) {
+			auto prim = objInfo.primitive(i);
+			// casts away constness, may be not legit
+			if (std::strcmp(prim->Class(), "Point") == 0)
+				((Point*)prim)->radius(_pointRadius);
+		}
+	}
+
+	bool cfExists = false;
+	bool uvExists = false;
+	for (int i = 0; i < objInfo.get_attribcontext_count(); i++) {
+		auto context = objInfo.get_attribcontext(i);
+		if (std::strcmp(context->name, "Cf") == 0)
+			cfExists = true;
+		else if (std::strcmp(context->name, "uv") == 0)
+			uvExists = true;
+	}
+	size_t numPoints = objInfo.point_list() ?
+				objInfo.point_list()->size() : 0;
+
+	if (!cfExists || relayout || _currentCf[0] != _cf[0] ||
+			_currentCf[1] != _cf[1] ||
+			_currentCf[2] != _cf[2]) {
+		Attribute* ca = out.writable_attribute(obj,
+				Group_Points, "Cf", VECTOR4_ATTRIB);
 		assert(ca);
+		for (size_t i = 0; i < numPoints; i++) {
+			ca->vector4(i).set(
+				_cf[0], _cf[1], _cf[2], 1.0f
+			);
+		}
+	}
 
-		auto c = ca->vector4(1);
-		if (c.x != _cf[0] || c.y != _cf[1] || c.z != _cf[2]) {
-			for (int i = 0; i < points->size(); i++) {
-				ca->vector4(i).set(
-					_cf[0], _cf[1], _cf[2], 1.0f
-				);
-			}
+	if (!uvExists || relayout) {
+		Attribute* uva = out.writable_attribute(obj, Group_Points,
+						"uv", VECTOR4_ATTRIB);
+		assert(uva);
+		const auto& uvs = data().uvs();
+		IndexView indices = layout().indices;
+		for (size_t i = 0; i < numPoints; i++) {
+			const Point3& uv = uvs.at(i < indices.size() ?
+						indices[i] : i);
+			uva->vector4(i).set(uv.x, uv.y, uv.z, 1.0f);
+		}
+	}
+}
+
+
+// An object for each face, they're recreated only when the number of
+// faces or the output mode changes, otherwise the fitted points are
+// swapped in. The out type is in the points' hash in this mode.
+void FaceFitOp::create_faces(GeometryList& out)
+{
+	bool relayout = false;
+	if (rebuild(Mask_Points) || rebuild(Mask_Primitives) ||
+						!_currentAllFaces) {
+		bool forced = _cachedReqInc != _updateReqInc;
+		if (inferFaces(_facePoints, _faceIdList)) {
+			// a frame without faces too, it's been fitted
+			std::vector<const Point3*> faces;
+			for (auto& points : _facePoints)
+				faces.push_back((const Point3*)points.data());
+			writeSequence((int)outputContext().frame(), forced,
+						_faceIdList, faces);
 		}
+		int numFaces = _facePoints.size();
+		if (rebuild(Mask_Primitives) || !_currentAllFaces ||
+				(int)out.objects() != numFaces ||
+				_currentOutType != _outType) {
+			out.delete_objects();
+			for (int obj = 0; obj < numFaces; obj++)
+				recreate_primitives(obj, out);
+			_currentOutType = _outType;
+			_currentAllFaces = true;
+			relayout = true;
+		}
+		// the buffers of the previous frame's points are reused
+		for (int obj = 0; obj < numFaces; obj++) {
+			out.writable_points(obj)->swap(_facePoints[obj]);
+			Attribute* id = out.writable_attribute(obj,
+					Group_Object, "face_id", INT_ATTRIB);
+			assert(id);
+			id->integer(0) = _faceIdList[obj];
+		}
+	}
+
+	if (rebuild(Mask_Attributes) || relayout) {
+		for (int obj = 0; obj < (int)out.objects(); obj++)
+			update_attributes(obj, out, relayout);
+		_currentPointRadius = _pointRadius;
+		std::copy(_cf, _cf + 3, _currentCf);
+	}
+}
+
+
+void FaceFitOp::create_geometry(Scene& scene, GeometryList& out)
+{
+	TRACE_SCOPE("create_geometry");
+	if (!waitForData())
+		return;
+	if (allFaces()) {
+		create_faces(out);
+		return;
+	}
+	int obj = 0;
 
-		bool uvExists = false;
-		for (int i = 0; i < objInfo.get_attribcontext_count(); i++) {
-			auto context = objInfo.get_attribcontext(i);
-			if (std::strcmp(context->name, "uv") == 0)
-				uvExists = true;
-			
+	// the faces' objects are dropped too
+	if (rebuild(Mask_Primitives) || _currentAllFaces) {
+		out.delete_objects();
+		recreate_primitives(obj, out);
+		_currentAllFaces = false;
+	}
+
+	if (rebuild(Mask_Points)) {
+		// fitted straight into the geometry's points
+		bool forced = _cachedReqInc != _updateReqInc;
+		PointList& points = *out.writable_points(obj);
+		if (infer(points)) {
+			writeSequence((int)outputContext().frame(), forced,
+				{ 0 }, { (const Point3*)points.data() });
 		}
+	}
 
-		if (!uvExists) {
-			Attribute* uva = out.writable_attribute(obj, Group_Points,
-							"uv", VECTOR4_ATTRIB);
-			assert(uva);
-			for (int i = 0; i < points->size(); i++) {
-				uva->vector4(i).set(
-					Nuke2TensorFlow::data.uvs().at(i));
-			}
+	if (rebuild(Mask_Attributes)) {
+		// the points of the new layout are there already, the
+		// primitives and the attributes are of the old one
+		bool relayout = _currentOutType != _outType;
+		if (relayout) {
+			// the points are swapped out while the object is
+			// recreated and back, rather than copied
+			_bufferPoints.swap(*out.writable_points(obj));
+			out.delete_objects();
+			recreate_primitives(obj, out);
+			out.writable_points(obj)->swap(_bufferPoints);
+			_bufferPoints.clear();
 		}
+		update_attributes(obj, out, relayout);
+		_currentPointRadius = _pointRadius;
+		std::copy(_cf, _cf + 3, _currentCf);
 	}
 }
 
@@ -315,6 +1259,35 @@ void FaceFitOp::get_geometry_hash()
 	// Recompute point locations only if input image has changed
 	geo_hash[Group_Points].append(input_iop()->hash());
 	geo_hash[Group_Points].append(_updateReqInc);
+	geo_hash[Group_Points].append(_keyframes);
+	// the key points' mode carries fewer points than the face's ones
+	geo_hash[Group_Points].append(_outType == kKeyPoints);
+	// the faces' objects are recreated with their points
+	geo_hash[Group_Points].append(allFaces());
+	if (allFaces())
+		geo_hash[Group_Points].append(_outType);
+	if (_keyframes) {
+		geo_hash[Group_Points].append(_keyInterval);
+		geo_hash[Group_Points].append(_maxMotion);
+	}
+	// the face is found or boxed otherwise
+	geo_hash[Group_Points].append(_faceDetector);
+	if (_faceDetector) {
+		geo_hash[Group_Points].append(_detectorType);
+		geo_hash[Group_Points].append(_minFaceSize);
+		geo_hash[Group_Points].append(_trackFace);
+	} else {
+		for (int i = 0; i < 4; i++)
+			geo_hash[Group_Points].append(_bBox[i]);
+	}
+	// the played back file's frames change as it's written
+	geo_hash[Group_Points].append(_sequenceMode);
+	if (_sequenceMode == kSequenceRead && _sequencePath) {
+		struct stat st;
+		geo_hash[Group_Points].append(_sequencePath);
+		if (stat(_sequencePath, &st) == 0)
+			geo_hash[Group_Points].append((U64)st.st_size);
+	}
 
 	// I use Mask_Attributes instead of Mask_Points for recreting primitives
 	// i.e. for geomoetry or facial points or key points because
@@ -323,6 +1296,7 @@ void FaceFitOp::get_geometry_hash()
 	// Since inference is rather slow, point locations should be recomputed
 	// as few times as possible.
 	geo_hash[Group_Attributes].append(_outType);
+	geo_hash[Group_Attributes].append(allFaces());
 
 	geo_hash[Group_Attributes].append(_cf[0]);
 	geo_hash[Group_Attributes].append(_cf[1]);
@@ -18,9 +18,16 @@
 #define FACEFIT_H_
 
 #include "nuke2tf.h"
-#include "prnet.h"
+#include "faceids.h"
+#include "inferpool.h"
+#include "infercache.h"
+#include "lazyload.h"
+#include "lookahead.h"
+#include "sequencefile.h"
 #include <DDImage/Iop.h>
 #include <DDImage/SourceGeo.h>
+#include <map>
+#include <memory>
 
 
 namespace facefit {
@@ -31,9 +38,7 @@ static const std::string kDataPath = "../Documents/projects/facefit/data";
 
 // TensorFlow model name
 static const std::string kModelName = "256_256_resfcn256_weight";
-// Paths to the actual files
-static const std::string kMetaGraphPath =
-				kDataPath + "/net-data/" + kModelName + ".meta";
+// Paths to the actual files, the models' are made of the checkpoint's
 static const std::string kCheckpointPath =
 				kDataPath + "/net-data/" + kModelName;
 static const std::string kDetectorModelPath =
@@ -44,10 +49,81 @@ static const std::string kKptIndicesPath =
 				kDataPath + "/uv-data/uv_kpt_ind.txt";
 static const std::string kTrianglesPath =
 				kDataPath + "/uv-data/triangles.txt";
+// The same data in a single file, made by facefit_assets
+static const std::string kStaticAssetPath =
+				kDataPath + "/uv-data/" + kStaticAssetName;
 
 static const char* kFaceFitClass = "FaceFit";
 static const int kPRNetResolution = 256;
 
+// With the detector only a region around the face found in the previous
+// inference is fetched, the region's size relative to the face. The crop
+// takes 1.6 of the face, the rest is room for the motion between frames.
+static const float kTrackRegionScale = 2.5f;
+// Pixels added around a fetched region for the interpolation
+static const int kRegionPadding = 4;
+
+// In the tracking mode a frame next to an inferred one is cropped around
+// the neighbour's key points and the detector isn't run. The tracking is
+// lost if the fitted key points overlap the box they were cropped with
+// less than this, and the detector runs anyway every so many frames.
+static const float kTrackMinOverlap = 0.5f;
+static const int kTrackRedetectInterval = 50;
+// Only the neighbours are read, the boxes of frames further than this from
+// the last inferred one are dropped
+static const int kTrackKeptFrames = 2;
+
+// Defaults of the keyframe mode's knobs, every 8th frame is inferred,
+// frames in between are inferred too if the key points move more than
+// 5% of the face's size between keyframes
+static const int kDefaultKeyInterval = 8;
+static const float kDefaultMaxMotion = 0.05f;
+
+// With "all faces" at most this many faces of a frame are fitted, in a
+// single batch. A face keeps the ID of the face it overlaps by this much
+// in the nearest fitted frame up to so many frames away.
+static const size_t kMaxFaces = 8;
+static const float kFaceIdMinOverlap = 0.3f;
+static const int kFaceIdMaxGap = 8;
+
+// The precision of the points written into a sequence file by default
+static const PointEncoding kDefaultSequencePrecision = kHalfPoints;
+
+// Frames fitted in the background ahead of the playhead by default
+static const int kDefaultLookAhead = 4;
+
+// All the nodes share this many sessions of the inference backend, each
+// one is a copy of the weights, FACEFIT_SESSIONS overrides it
+static const int kDefaultSessions = 1;
+static const char* kSessionsEnv = "FACEFIT_SESSIONS";
+// If it's set, the sessions are loaded and run once as soon as a node is
+// created, otherwise on the first inference
+static const char* kWarmUpEnv = "FACEFIT_WARMUP";
+// The model's variant, "float" for the frozen graph if it's there, "fp16"
+// and "int8" for the reduced precision ones, quicker on CPU-only nodes
+// and less accurate, "meta" for the meta graph and the checkpoint.
+// FACEFIT_MODEL overrides it.
+static const ModelVariant kDefaultModelVariant = kFrozen;
+static const char* kModelEnv = "FACEFIT_MODEL";
+// The inference engine, "tensorflow" or "onnx" if the plug-in is built
+// with it, FACEFIT_BACKEND overrides the build's default
+static const char* kBackendEnv = "FACEFIT_BACKEND";
+
+// The cores the sessions and the conversions of all the nodes share, e.g.
+// FACEFIT_THREADS=8, and FACEFIT_THREADS=8@16 pins them to the cores
+// 16-23. Without it TF, ONNX Runtime and dlib use all the cores each.
+static const char* kThreadsEnv = "FACEFIT_THREADS";
+
+// Inferred frames are kept in memory up to this size in megabytes,
+// FACEFIT_CACHE_MB overrides it. If FACEFIT_CACHE_DIR is set, the frames
+// are also written there and survive reopening of the script, the
+// directory is kept under FACEFIT_CACHE_DISK_MB, 0 doesn't limit it.
+static const size_t kCacheSizeMB = 512;
+static const char* kCacheSizeEnv = "FACEFIT_CACHE_MB";
+static const char* kCacheDirEnv = "FACEFIT_CACHE_DIR";
+static const size_t kCacheDiskMB = 4096;
+static const char* kCacheDiskEnv = "FACEFIT_CACHE_DISK_MB";
+
 
 using namespace DD::Image;
 
@@ -69,13 +145,47 @@ protected:
 	virtual void get_geometry_hash();
 
 private:
-	static thread_local PRNet _net;
+	static InferencePool _pool;
+	static LazyLoad<Nuke2TensorFlow::StaticData> _data;
+	static InferenceCache _cache;
+	// the sequence files being written, by path, all the instances
+	// append to the same one and they're closed at exit
+	static std::map<std::string, std::unique_ptr<SequenceWriter>>
+								_writers;
+	static std::mutex _writersMutex;
 	Nuke2TensorFlow _n2tf;
+	// the keyframes' points, and the geometry's while the object is
+	// recreated
 	PointList _bufferPoints;
 
+	// the faces' points while their objects are recreated, in the
+	// order of their IDs
+	std::vector<PointList> _facePoints;
+	std::vector<int> _faceIdList;
+	// the IDs of the first instance are shared by the node's instances
+	FaceIds _faceIds;
+
 	// knobs
 	bool _pointCloud;
 	bool _faceDetector;
+	int _detectorType;
+	int _minFaceSize;
+	const char* const _detectorNames[3] = { "HOG", "CNN", 0 };
+	bool _allFaces;
+	bool _trackFace;
+	bool _keyframes;
+	int _keyInterval;
+	float _maxMotion;
+	int _lookAheadFrames;
+	bool _useCache;
+	const char* _sequencePath;
+	const char* const _sequenceModeNames[4] =
+			{ "off", "write", "read", 0 };
+	enum _sequenceModes { kSequenceOff, kSequenceWrite, kSequenceRead };
+	int _sequenceMode;
+	const char* const _precisionNames[4] =
+			{ "float", "half", "int16", 0 };
+	int _sequencePrecision;
 	float _bBox[4];
 	float _pointRadius;
 	float _cf[3];
@@ -87,10 +197,74 @@ private:
 
 	int _currentOutType;
 	float _currentPointRadius;
+	// the colour the points' Cf was filled with
+	float _currentCf[3];
+	unsigned _cachedReqInc;
+	// the objects are of the faces rather than of a single one
+	bool _currentAllFaces;
+	dlib::rectangle _lastFace;
+	bool _hasLastFace;
+
+	// the key points' boxes of inferred frames, and how many frames
+	// ago the face was detected
+	struct TrackedFace
+	{
+		dlib::rectangle face;
+		int run;
+	};
+	std::map<int, TrackedFace> _tracked;
+
+	// the sequence file played back, reopened when it has grown
+	SequenceReader _sequenceReader;
+	std::string _readerPath;
+	size_t _readerSize;
+
+	// detects and extracts for the look-ahead's stages
+	Nuke2TensorFlow _aheadN2tf;
+
+	static Nuke2TensorFlow::StaticData& data() { return _data.get(); }
+	// the points of the output mode, only they are extracted
+	const PointLayout& layout() const;
+	// the primitives of the output mode over the layout's points
+	const Topology& topology() const;
+	bool waitForData();
+	DetectorConfig detectorConfig() const;
+	static ChannelSet channels();
+	ImageView fetch(Iop* input, ImagePlane& plane);
+	Iop* inputAt(int frame);
+	// the key points alone are cached apart from the face's points
+	Hash inferenceKey(Iop* input, bool keyPoints);
+	const TrackedFace* trackedNeighbour(int frame) const;
+	void setTracked(int frame, const TrackedFace& tracked);
+	bool fit(const FloatTensor& input, PointList& points);
+	bool inferFrame(Iop* input, int frame, bool forced, bool useCache,
+						PointList& points);
+	// false if the points are the default ones
+	bool infer(PointList& points);
+	// every face with the detector, a geometry object for each one
+	bool allFaces() const { return _allFaces && _faceDetector; }
+	FaceIds& faceIds();
+	bool inferFaces(std::vector<PointList>& faces, std::vector<int>& ids);
+
+	// the output mode's points and primitives as a sequence file has them
+	SequenceLayout sequenceLayout() const;
+	SequenceWriter* sequenceWriter();
+	void writeSequence(int frame, bool forced, const std::vector<int>& ids,
+				const std::vector<const Point3*>& faces);
+	// null unless it's a sequence of the output mode's points
+	const SequenceReader* sequenceReader();
+	bool readSequenceFace(const SequenceReader& reader, int frame,
+					int face, PointList& points) const;
+	void create_faces(GeometryList& out);
+	void recreate_primitives(int obj, GeometryList& out);
+	void update_attributes(int obj, GeometryList& out, bool relayout);
 
-	void infer(bool modify);
-	void recreate_primitives(int obj, GeometryList& out,
-				const std::vector<int>& indices);
+	LookAhead& lookAhead();
+	LookAheadJobPtr createFitJob(int frame);
+	bool warpStage(LookAheadJob& job);
+	bool inferStage(LookAheadJob& job);
+	// the last member, its threads are stopped before the rest is gone
+	std::unique_ptr<LookAhead> _lookAhead;
 
 }; // class
 
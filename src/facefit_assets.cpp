@@ -0,0 +1,93 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Converts PRNet's text index files into the binary asset the plug-in
+// and the command line tools map at startup, see faceassets.h. The text
+// files stay as the fallback if the asset is missing or out of date.
+//
+// usage: facefit_assets [-d data dir] [-o asset path]
+//   the asset goes to <data dir>/uv-data/static_data.ffsd by default
+
+#include "faceassets.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+
+static const int kResolution = 256;
+
+
+template <typename T>
+static bool same(ArrayView<T> a, ArrayView<T> b)
+{
+	return a.size() == b.size() && (a.empty() ||
+		std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = "data";
+	std::string outPath;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-d" && i + 1 < argc) {
+			dataPath = argv[++i];
+		} else if (arg == "-o" && i + 1 < argc) {
+			outPath = argv[++i];
+		} else {
+			std::cout << "usage: facefit_assets [-d data dir] "
+						"[-o asset path]\n";
+			return 1;
+		}
+	}
+	if (outPath.empty())
+		outPath = dataPath + "/uv-data/" + kStaticAssetName;
+
+	FaceAssets text;
+	if (!text.loadText(dataPath + "/uv-data/triangles.txt",
+				dataPath + "/uv-data/face_ind.txt",
+				dataPath + "/uv-data/uv_kpt_ind.txt",
+				kResolution)) {
+		std::cout << "Couldn't read the text files in "
+					<< dataPath << "/uv-data\n";
+		return 1;
+	}
+	if (!text.write(outPath)) {
+		std::cout << "Couldn't write " << outPath << "\n";
+		return 1;
+	}
+
+	// read it back the way the plug-in does
+	FaceAssets mapped;
+	if (!mapped.map(outPath, kResolution) ||
+			!same(text.faceIndices(), mapped.faceIndices()) ||
+			!same(text.kptIndices(), mapped.kptIndices()) ||
+			!same(text.triIndices(), mapped.triIndices()) ||
+			!same(text.defaultPoints(), mapped.defaultPoints()) ||
+			!same(text.uvs(), mapped.uvs())) {
+		std::cout << "The written asset doesn't match the text files\n";
+		return 1;
+	}
+
+	std::cout << outPath << ": " << text.faceIndices().size()
+		<< " face indices, " << text.kptIndices().size()
+		<< " key points, " << text.triIndices().size() / 3
+		<< " triangles\n";
+	return 0;
+}
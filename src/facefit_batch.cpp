@@ -0,0 +1,383 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// A command line fitter running the same pipeline as the plug-in,
+// detect -> warp -> infer -> extract, without the Nuke SDK, e.g. for
+// precomputing point data on a farm. Every frame gets <name>.xyz in the
+// output directory with a point per line in the plug-in's coordinates.
+//
+// usage: facefit_batch [options] image...
+//   -d <dir>      data directory, ./data by default
+//   -o <dir>      output directory, the current one by default
+//   -b <n>        frames per Session::Run
+//   -k            write only the key points
+//   -r l,t,r,b    use the box (top-down pixels) instead of the detector
+//   -f hog|cnn    face detector, hog by default, cnn loads its model
+//   -s <px>       smallest face to detect, a sixth of the height by default
+//   -m <variant>  model: float (default), fp16, int8 or meta
+//   -e <engine>   inference backend: tensorflow or onnx, the ones built
+//   -t <n>[@core] threads of the session and the conversions together,
+//                 pinned to the cores from the given one, all by default
+//   -c <dir>      also write the network's input crops as <name>.ppm,
+//                 e.g. for calibrating quantize_graph.py
+//   -q <file>     write a sequence file instead of the .xyz files, of the
+//                 face's points with the mesh or of the key points with -k,
+//                 an image's frame is its position among the images, a
+//                 frame without a face is written without faces, the
+//                 frames an existing file has already are skipped
+//   -p <coding>   the sequence's points: float, half (default) or int16
+//   -i <n>        the sequence's frame of the first image, 0 by default
+//
+// Images are PNG, JPEG, BMP (whatever dlib was built with) or binary PPM,
+// they are decoded into linear floats like Nuke would provide.
+//
+// It exits with 0 if every frame is fitted, 2 if some had no face and the
+// rest are fitted, 3 if a frame has failed, e.g. an image which couldn't
+// be read, the inference or writing, and 1 for wrong options or a model
+// which couldn't be loaded.
+
+#include "imageio.h"
+#include "nuke2tf.h"
+#include "prnet.h"
+#include "sequencefile.h"
+#include "threadbudget.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+
+using namespace dlib;
+
+
+static const int kResolution = 256;
+
+
+struct Frame
+{
+	std::string path;
+	int number = 0;
+	LinearImage image;
+	bool loaded = false;
+};
+
+
+static void loadFrames(std::vector<Frame>& frames)
+{
+	parallel_for(hostThreadPool(), size_t(0), frames.size(), [&](size_t i) {
+		frames[i].loaded = loadLinearImage(frames[i].path,
+							frames[i].image);
+		if (!frames[i].loaded)
+			std::cout << "Couldn't read " << frames[i].path << "\n";
+	});
+}
+
+
+static bool writePoints(const std::string& path, const Point3List& points)
+{
+	FILE* f = std::fopen(path.c_str(), "w");
+	if (!f)
+		return false;
+	for (const Point3& p : points)
+		std::fprintf(f, "%.6g %.6g %.6g\n", p.x, p.y, p.z);
+	return std::fclose(f) == 0;
+}
+
+
+static std::string outputPath(const std::string& outDir,
+				const std::string& imagePath,
+				const std::string& extension = ".xyz")
+{
+	size_t slash = imagePath.rfind('/');
+	std::string name = slash == std::string::npos ?
+				imagePath : imagePath.substr(slash + 1);
+	size_t dot = name.rfind('.');
+	if (dot != std::string::npos)
+		name = name.substr(0, dot);
+	return outDir + "/" + name + extension;
+}
+
+
+static void usage()
+{
+	std::cout << "usage: facefit_batch [-d data dir] [-o output dir] "
+		"[-b batch size] [-k] [-r l,t,r,b] [-f hog|cnn] "
+		"[-s min face size] [-m float|fp16|int8|meta] "
+		"[-e tensorflow|onnx] [-t threads[@core]] [-c crop dir] "
+		"[-q sequence file] [-p float|half|int16] [-i first frame] "
+		"image...\n";
+}
+
+
+int main(int argc, char** argv)
+{
+	std::string dataPath = "data";
+	std::string outDir = ".";
+	int batchSize = kDefaultBatchSize;
+	bool keyPoints = false;
+	bool useDetector = true;
+	DetectorConfig detector;
+	ModelConfig config;
+	ThreadBudget budget;
+	std::string cropDir;
+	std::string sequencePath;
+	PointEncoding encoding = kHalfPoints;
+	int firstFrame = 0;
+	rectangle userBBox;
+	std::vector<std::string> paths;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-d" && hasValue) {
+			dataPath = argv[++i];
+		} else if (arg == "-o" && hasValue) {
+			outDir = argv[++i];
+		} else if (arg == "-b" && hasValue) {
+			batchSize = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "-k") {
+			keyPoints = true;
+		} else if (arg == "-r" && hasValue) {
+			long l, t, r, b;
+			if (std::sscanf(argv[++i], "%ld,%ld,%ld,%ld",
+						&l, &t, &r, &b) != 4) {
+				usage();
+				return 1;
+			}
+			userBBox = rectangle(l, t, r, b);
+			useDetector = false;
+		} else if (arg == "-f" && hasValue) {
+			if (!parseDetector(argv[++i], detector.type)) {
+				usage();
+				return 1;
+			}
+		} else if (arg == "-s" && hasValue) {
+			detector.minFaceSize = std::max(0, std::atoi(argv[++i]));
+		} else if (arg == "-m" && hasValue) {
+			if (!parseModelVariant(argv[++i], config.variant)) {
+				usage();
+				return 1;
+			}
+		} else if (arg == "-e" && hasValue) {
+			if (!parseBackend(argv[++i], config.backend)) {
+				usage();
+				return 1;
+			}
+		} else if (arg == "-t" && hasValue) {
+			if (!budget.parse(argv[++i])) {
+				usage();
+				return 1;
+			}
+		} else if (arg == "-c" && hasValue) {
+			cropDir = argv[++i];
+		} else if (arg == "-q" && hasValue) {
+			sequencePath = argv[++i];
+		} else if (arg == "-i" && hasValue) {
+			firstFrame = std::atoi(argv[++i]);
+		} else if (arg == "-p" && hasValue) {
+			if (!parsePointEncoding(argv[++i], encoding)) {
+				usage();
+				return 1;
+			}
+		} else if (arg[0] == '-') {
+			usage();
+			return 1;
+		} else {
+			paths.push_back(arg);
+		}
+	}
+	if (paths.empty()) {
+		usage();
+		return 1;
+	}
+	std::vector<int> numbers;
+	for (size_t i = 0; i < paths.size(); i++)
+		numbers.push_back(firstFrame + i);
+
+	// every thread from here on is started by the pinned main one
+	setThreadBudget(budget);
+	if (!pinThread(budget))
+		std::cout << "Couldn't pin the threads\n";
+	config.threads = budget.threads;
+
+	config.checkpointPath = dataPath +
+				"/net-data/256_256_resfcn256_weight";
+	Nuke2TensorFlow::StaticData data(
+		dataPath + "/net-data/mmod_human_face_detector.dat",
+		dataPath + "/uv-data/triangles.txt",
+		dataPath + "/uv-data/face_ind.txt",
+		dataPath + "/uv-data/uv_kpt_ind.txt",
+		kResolution,
+		dataPath + "/uv-data/" + kStaticAssetName);
+	PRNet net(config, batchSize);
+	if (!net.loaded())
+		return 1;
+	Nuke2TensorFlow n2tf(kResolution);
+	n2tf.setDetector(detector, &data.cnnDetector);
+	// with -k only the key points are extracted
+	IndexView indices = keyPoints ? data.kptLayout().indices : IndexView();
+
+	// the sequence has the plug-in's points and primitives of the mesh
+	// or the key points mode, so that the plug-in plays it back
+	const PointLayout& layout = keyPoints ? data.kptLayout() :
+						data.faceLayout();
+	const Topology& topology = keyPoints ? data.kptTopology() :
+						data.meshTopology();
+	SequenceWriter sequence;
+	if (!sequencePath.empty()) {
+		SequenceLayout sequenceLayout;
+		sequenceLayout.resolution = kResolution;
+		sequenceLayout.indices.assign(layout.indices.begin(),
+						layout.indices.end());
+		sequenceLayout.kptIndices.assign(layout.kptIndices.begin(),
+						layout.kptIndices.end());
+		sequenceLayout.triangles = topology.triangles;
+		sequenceLayout.lines = topology.lines;
+		if (!sequence.open(sequencePath, sequenceLayout, encoding)) {
+			std::cout << "Couldn't write " << sequencePath
+				<< ", an existing file must be a sequence of "
+				"the same points and precision\n";
+			return 1;
+		}
+
+		// a run which has failed is resumed where it's stopped
+		size_t kept = 0;
+		for (size_t i = 0; i < paths.size(); i++) {
+			if (sequence.contains(numbers[i]))
+				continue;
+			paths[kept] = paths[i];
+			numbers[kept++] = numbers[i];
+		}
+		if (kept < paths.size())
+			std::cout << "Skipping " << paths.size() - kept
+				<< " frames fitted already\n";
+		paths.resize(kept);
+		numbers.resize(kept);
+	}
+
+	auto chunk = [&](size_t first) {
+		std::vector<Frame> frames(
+			std::min(paths.size() - first, (size_t)batchSize));
+		for (size_t i = 0; i < frames.size(); i++) {
+			frames[i].path = paths[first + i];
+			frames[i].number = numbers[first + i];
+		}
+		loadFrames(frames);
+		return frames;
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	size_t numFitted = 0;
+	size_t numNoFace = 0;
+
+	// the next chunk is decoded while the current one is being fitted,
+	// the session itself spreads over the budget's cores
+	auto next = std::async(std::launch::async, chunk, 0);
+	for (size_t first = 0; first < paths.size(); first += batchSize) {
+		std::vector<Frame> frames = next.get();
+		if (first + batchSize < paths.size())
+			next = std::async(std::launch::async, chunk,
+							first + batchSize);
+
+		std::vector<ImageView> views;
+		std::vector<Frame*> loaded;
+		for (auto& frame : frames) {
+			if (frame.loaded) {
+				views.push_back(frame.image.view());
+				loaded.push_back(&frame);
+			}
+		}
+
+		std::vector<size_t> fitted;
+		auto input = n2tf.imagePlanes2Tensor(views, userBBox,
+							useDetector, fitted);
+
+		// the frames without a face are done too, a sequence has them
+		// without faces, so that a resumed run skips them
+		std::vector<bool> hasFace(loaded.size(), false);
+		for (size_t k : fitted)
+			hasFace[k] = true;
+		for (size_t i = 0; i < loaded.size(); i++) {
+			if (hasFace[i])
+				continue;
+			if (!sequencePath.empty() &&
+					!sequence.write(loaded[i]->number, {}, {}))
+				std::cout << "Couldn't write frame "
+					<< loaded[i]->number << "\n";
+			else
+				numNoFace++;
+		}
+		if (input.dims() != 4)
+			continue;
+		if (!cropDir.empty()) {
+			for (size_t k = 0; k < fitted.size(); k++) {
+				std::string path = outputPath(cropDir,
+					loaded[fitted[k]]->path, ".ppm");
+				if (!saveCrop(path, input.item(k), kResolution,
+								kResolution))
+					std::cout << "Couldn't write " << path
+								<< "\n";
+			}
+		}
+		auto output = net.infer(input);
+		if (output.dims() != 4)
+			continue;
+
+		Point3List points;
+		for (size_t k = 0; k < fitted.size(); k++) {
+			const Frame* frame = loaded[fitted[k]];
+			if (!sequencePath.empty()) {
+				points.resize(layout.size(kResolution));
+				n2tf.extractDataFromTensor(output,
+					n2tf.batchCrops()[k], layout,
+					points.data(), k);
+				if (!sequence.write(frame->number, { 0 },
+							{ points.data() }))
+					std::cout << "Couldn't write frame "
+						<< frame->number << "\n";
+				else
+					numFitted++;
+				continue;
+			}
+			n2tf.extractDataFromTensor(output,
+					n2tf.batchCrops()[k], points,
+					indices, k);
+			std::string path = outputPath(outDir, frame->path);
+			if (!writePoints(path, points))
+				std::cout << "Couldn't write " << path << "\n";
+			else
+				numFitted++;
+		}
+	}
+
+	if (!sequencePath.empty() && !sequence.close())
+		std::cout << "Couldn't write the index of " << sequencePath
+								<< "\n";
+
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	size_t numFailed = paths.size() - numFitted - numNoFace;
+	std::cout << "Fitted " << numFitted << " of " << paths.size()
+		<< " frames in " << elapsed.count() << " s, "
+		<< paths.size() / elapsed.count() << " fps, " << numNoFace
+		<< " without a face, " << numFailed << " failed\n";
+	if (numFailed > 0)
+		return 3;
+	return numNoFace > 0 ? 2 : 0;
+}
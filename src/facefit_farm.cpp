@@ -0,0 +1,127 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+// Fits a take with several facefit_batch processes on one machine, a
+// process reaches only so many cores with a single session. The images
+// are split into frame ranges, each worker fits its range with its own
+// pinned share of the cores and a model of its own into a part, and the
+// parts are merged into a single sequence file. A failed shard is started
+// again, resuming from its last written frame, and running the same
+// command again after a failure fits only the shards which aren't done.
+//
+// usage: facefit_farm [options] -q take.ffsq image...
+//   -w <n>        workers at once, 1 by default
+//   -n <n>        frames per shard, by default a shard for each worker
+//   -t <n>        threads of each worker, the cores divided by default
+//   -u            don't pin the workers to cores
+//   -R <n>        times a failed shard is retried, 2 by default
+//   -x <path>     facefit_batch, the one next to facefit_farm by default
+//   -K            keep the parts and the workers' logs after the merge
+//   -d, -b, -k, -r, -f, -s, -m, -e, -c, -p are passed to facefit_batch
+
+#include "shards.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+
+static void usage()
+{
+	std::cout << "usage: facefit_farm [-w workers] [-n shard frames] "
+		"[-t threads] [-u] [-R retries] [-x facefit_batch] [-K] "
+		"[facefit_batch options] -q sequence file image...\n";
+}
+
+
+int main(int argc, char** argv)
+{
+	FarmConfig config;
+	std::string argv0 = argv[0];
+	size_t slash = argv0.rfind('/');
+	if (slash != std::string::npos)
+		config.batchPath = argv0.substr(0, slash + 1) + "facefit_batch";
+
+	std::string output;
+	int shardFrames = 0;
+	bool keep = false;
+	std::vector<std::string> images;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-w" && hasValue) {
+			config.workers = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "-n" && hasValue) {
+			shardFrames = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "-t" && hasValue) {
+			config.threads = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "-u") {
+			config.pin = false;
+		} else if (arg == "-R" && hasValue) {
+			config.retries = std::max(0, std::atoi(argv[++i]));
+		} else if (arg == "-x" && hasValue) {
+			config.batchPath = argv[++i];
+		} else if (arg == "-K") {
+			keep = true;
+		} else if (arg == "-q" && hasValue) {
+			output = argv[++i];
+		} else if (arg == "-k") {
+			config.batchArgs.push_back(arg);
+		} else if (arg[0] == '-' && arg.size() == 2 && hasValue &&
+					std::strchr("dbrfsmecp", arg[1])) {
+			config.batchArgs.push_back(arg);
+			config.batchArgs.push_back(argv[++i]);
+		} else if (arg[0] == '-') {
+			usage();
+			return 1;
+		} else {
+			images.push_back(arg);
+		}
+	}
+	if (output.empty() || images.empty()) {
+		usage();
+		return 1;
+	}
+
+	std::vector<Shard> shards = planShards(output, images.size(),
+					shardFrames, config.workers);
+	std::cout << images.size() << " frames in " << shards.size()
+		<< " shards, " << config.workers << " workers\n";
+
+	auto start = std::chrono::steady_clock::now();
+	bool ok = runShards(config, images, shards);
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	if (!ok) {
+		std::cout << "Some shards have failed, the parts are kept, "
+			"running the same command again fits the rest\n";
+		return 2;
+	}
+
+	if (!mergeShards(shards, output)) {
+		std::cout << "Couldn't merge the parts into " << output << "\n";
+		return 1;
+	}
+	if (!keep)
+		removeShards(shards);
+	std::cout << "Fitted " << images.size() << " frames in "
+		<< elapsed.count() << " s, " << images.size() / elapsed.count()
+		<< " fps, written " << output << "\n";
+	return 0;
+}
@@ -0,0 +1,114 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "faceids.h"
+
+#include <dlib/image_processing/box_overlap_testing.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <tuple>
+
+
+const std::vector<FaceIds::Face>* FaceIds::nearest(int frame) const
+{
+	if (_frames.empty())
+		return nullptr;
+	auto after = _frames.lower_bound(frame);
+	auto best = _frames.end();
+	if (after != _frames.end())
+		best = after;
+	if (after != _frames.begin()) {
+		auto before = std::prev(after);
+		if (best == _frames.end() ||
+				frame - before->first < best->first - frame)
+			best = before;
+	}
+	if (std::abs(best->first - frame) > _maxGap)
+		return nullptr;
+	return &best->second;
+}
+
+
+std::vector<int> FaceIds::identify(int frame,
+				const std::vector<dlib::rectangle>& faces)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<int> ids(faces.size(), -1);
+	const std::vector<Face>* known = nearest(frame);
+
+	// the best overlapping pairs first, a face is taken only once
+	if (known) {
+		std::vector<std::tuple<double, size_t, size_t>> pairs;
+		for (size_t i = 0; i < faces.size(); i++) {
+			for (size_t j = 0; j < known->size(); j++) {
+				double overlap = dlib::box_intersection_over_union(
+						faces[i], (*known)[j].box);
+				if (overlap >= _minOverlap)
+					pairs.emplace_back(overlap, i, j);
+			}
+		}
+		std::sort(pairs.begin(), pairs.end(),
+			[](const std::tuple<double, size_t, size_t>& a,
+			   const std::tuple<double, size_t, size_t>& b) {
+				return std::get<0>(a) > std::get<0>(b);
+			});
+		std::vector<bool> taken(known->size(), false);
+		for (auto& pair : pairs) {
+			size_t i = std::get<1>(pair), j = std::get<2>(pair);
+			if (ids[i] >= 0 || taken[j])
+				continue;
+			ids[i] = (*known)[j].id;
+			taken[j] = true;
+		}
+	}
+
+	std::vector<size_t> unknown;
+	for (size_t i = 0; i < faces.size(); i++) {
+		if (ids[i] < 0)
+			unknown.push_back(i);
+	}
+	std::sort(unknown.begin(), unknown.end(), [&](size_t a, size_t b) {
+		return faces[a].left() < faces[b].left();
+	});
+	for (size_t i : unknown)
+		ids[i] = _nextId++;
+
+	std::vector<Face>& identified = _frames[frame];
+	identified.clear();
+	for (size_t i = 0; i < faces.size(); i++)
+		identified.push_back({ ids[i], faces[i] });
+	return ids;
+}
+
+
+void FaceIds::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_frames.clear();
+	_nextId = 0;
+}
+
+
+void FaceIds::setContext(uint64_t context)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (context == _context)
+		return;
+	_context = context;
+	_frames.clear();
+	_nextId = 0;
+}
@@ -0,0 +1,61 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef FACEIDS_H_
+#define FACEIDS_H_
+
+#include <dlib/geometry.h>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+
+// The IDs of the faces fitted in several frames, a face keeps the ID of
+// the face it overlaps the most in the nearest frame which has been
+// identified within maxGap frames, the same frame again included. The
+// rest get new IDs in the order from left to right. Frames are usually
+// evaluated in order, the IDs of frames reached by jumping further than
+// maxGap depend on the order. Several threads may identify at once.
+class FaceIds {
+public:
+	FaceIds(float minOverlap, int maxGap) :
+		_minOverlap(minOverlap), _maxGap(maxGap) {}
+	// an ID for each of the faces' boxes in their order
+	std::vector<int> identify(int frame,
+				const std::vector<dlib::rectangle>& faces);
+	void clear();
+	// What the faces are detected on and with, e.g. a hash of the input
+	// and the detector's settings, the IDs are forgotten when it changes
+	void setContext(uint64_t context);
+private:
+	struct Face
+	{
+		int id;
+		dlib::rectangle box;
+	};
+	float _minOverlap;
+	int _maxGap;
+	int _nextId = 0;
+	uint64_t _context = 0;
+	std::map<int, std::vector<Face>> _frames;
+	std::mutex _mutex;
+
+	const std::vector<Face>* nearest(int frame) const;
+};
+
+
+#endif // FACEIDS_H_
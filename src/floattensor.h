@@ -0,0 +1,75 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef FLOATTENSOR_H_
+#define FLOATTENSOR_H_
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+
+// A batch of [n,H,W,C] float images, the network's input and output
+// independent of the inference engine. Copies and slices share the
+// buffer like tensorflow::Tensor's do, a backend can wrap its own output
+// without a copy by passing the object which owns the memory.
+class FloatTensor {
+public:
+	FloatTensor() {}
+	// the contents are uninitialised
+	FloatTensor(int64_t n, int64_t h, int64_t w, int64_t c) :
+		_dims{n, h, w, c}
+	{
+		_owner = std::shared_ptr<float>(new float[size()],
+					std::default_delete<float[]>());
+		_data = static_cast<float*>(_owner.get());
+	}
+	FloatTensor(std::shared_ptr<void> owner, float* data,
+			int64_t n, int64_t h, int64_t w, int64_t c) :
+		_owner(owner), _data(data), _dims{n, h, w, c} {}
+
+	// 4 or 0 if it's empty, e.g. a failed inference's result
+	int dims() const { return _data ? 4 : 0; }
+	int64_t dimSize(int i) const { return _dims[i]; }
+	// number of floats
+	int64_t size() const
+	{
+		return _dims[0] * _dims[1] * _dims[2] * _dims[3];
+	}
+	// floats in a batch item
+	int64_t itemSize() const { return _dims[1] * _dims[2] * _dims[3]; }
+	float* data() const { return _data; }
+	float* item(int64_t i) const { return _data + i * itemSize(); }
+	void setZero() const
+	{
+		std::memset(_data, 0, size() * sizeof(float));
+	}
+
+	// Items [first, last) of the batch, the buffer is shared
+	FloatTensor slice(int64_t first, int64_t last) const
+	{
+		return FloatTensor(_owner, item(first),
+				last - first, _dims[1], _dims[2], _dims[3]);
+	}
+
+private:
+	std::shared_ptr<void> _owner;
+	float* _data = nullptr;
+	int64_t _dims[4] = {0, 0, 0, 0};
+};
+
+
+#endif // FLOATTENSOR_H_
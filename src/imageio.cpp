@@ -0,0 +1,148 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "imageio.h"
+
+#include <dlib/image_io.h>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+using namespace dlib;
+
+
+// dlib doesn't read PPM, a minimal P6 reader, 8 bit only
+static bool loadPPM(const std::string& path, matrix<rgb_pixel>& img)
+{
+	FILE* f = std::fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	int w, h, maxVal;
+	bool ok = std::fscanf(f, "P6 %d %d %d", &w, &h, &maxVal) == 3 &&
+		maxVal == 255 && std::fgetc(f) != EOF;
+	if (ok) {
+		img.set_size(h, w);
+		std::vector<unsigned char> row(w * 3);
+		for (int i = 0; ok && i < h; i++) {
+			ok = std::fread(row.data(), 1, row.size(), f) ==
+								row.size();
+			for (int j = 0; ok && j < w; j++)
+				img(i, j) = rgb_pixel(row[j * 3],
+						row[j * 3 + 1], row[j * 3 + 2]);
+		}
+	}
+	std::fclose(f);
+	return ok;
+}
+
+
+// Decodes 8 bit sRGB into linear floats, the value is taken from
+// the middle of the quantisation step so the pipeline's conversion
+// back to 8 bits gives the original value.
+static const std::vector<float>& srgb2linearTable()
+{
+	static const std::vector<float> table = [] {
+		std::vector<float> t(256);
+		for (int i = 0; i < 256; i++) {
+			double c = (i + 0.5) / 255.0;
+			t[i] = c > 0.04045 ?
+				std::pow((c + 0.055) / 1.055, 2.4) : c / 12.92;
+		}
+		return t;
+	}();
+	return table;
+}
+
+
+ImageView LinearImage::view() const
+{
+	ImageView view;
+	view.data = pixels.data();
+	view.width = width;
+	view.height = height;
+	view.rowStride = width * 3;
+	view.colStride = 3;
+	view.chanStride = 1;
+	return view;
+}
+
+
+void rgb2linear(const matrix<rgb_pixel>& img, LinearImage& image)
+{
+	const auto& table = srgb2linearTable();
+	int h = img.nr(), w = img.nc();
+	image.width = w;
+	image.height = h;
+	image.pixels.resize(h * w * 3);
+	for (int i = 0; i < h; i++) {
+		float* dst = &image.pixels[i * w * 3];
+		for (int j = 0; j < w; j++) {
+			rgb_pixel p = img(i, j);
+			dst[j * 3] = table[p.red];
+			dst[j * 3 + 1] = table[p.green];
+			dst[j * 3 + 2] = table[p.blue];
+		}
+	}
+}
+
+
+bool loadImage(const std::string& path, matrix<rgb_pixel>& img)
+{
+	std::string ext = path.substr(path.rfind('.') + 1);
+	try {
+		if (ext == "ppm" || ext == "PPM") {
+			if (!loadPPM(path, img))
+				return false;
+		} else {
+			load_image(img, path);
+		}
+	} catch (std::exception& e) {
+		std::cout << e.what() << "\n";
+		return false;
+	}
+	return true;
+}
+
+
+bool loadLinearImage(const std::string& path, LinearImage& image)
+{
+	matrix<rgb_pixel> img;
+	if (!loadImage(path, img))
+		return false;
+	rgb2linear(img, image);
+	return true;
+}
+
+
+bool saveCrop(const std::string& path, const float* rgb, int width,
+								int height)
+{
+	FILE* f = std::fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+	std::fprintf(f, "P6\n%d %d\n255\n", width, height);
+	std::vector<unsigned char> row(width * 3);
+	bool ok = true;
+	for (int i = 0; ok && i < height; i++) {
+		for (int j = 0; j < width * 3; j++) {
+			float c = rgb[i * width * 3 + j];
+			c = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+			row[j] = (unsigned char)(c * 255.0f + 0.5f);
+		}
+		ok = std::fwrite(row.data(), 1, row.size(), f) == row.size();
+	}
+	return std::fclose(f) == 0 && ok;
+}
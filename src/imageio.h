@@ -0,0 +1,47 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef IMAGEIO_H_
+#define IMAGEIO_H_
+
+#include "imageview.h"
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+#include <string>
+
+
+// An image decoded into interleaved linear float RGB, what Nuke would
+// provide for an sRGB file
+struct LinearImage
+{
+	std::vector<float> pixels;
+	int width = 0;
+	int height = 0;
+
+	ImageView view() const;
+};
+
+// Reads PNG, JPEG, BMP (whatever dlib was built with) or binary PPM
+bool loadImage(const std::string& path, dlib::matrix<dlib::rgb_pixel>& img);
+bool loadLinearImage(const std::string& path, LinearImage& image);
+void rgb2linear(const dlib::matrix<dlib::rgb_pixel>& img, LinearImage& image);
+// Writes a network's input, interleaved sRGB floats in 0..1, as a binary
+// PPM, quantize_graph.py calibrates on them
+bool saveCrop(const std::string& path, const float* rgb, int width,
+								int height);
+
+
+#endif // IMAGEIO_H_
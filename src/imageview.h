@@ -0,0 +1,92 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef IMAGEVIEW_H_
+#define IMAGEVIEW_H_
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+
+// A read-only view of a linear float RGB image. Rows go from top to bottom,
+// strides are in floats, so Nuke's bottom-up planes are viewed with
+// a negative row stride and no copy.
+struct ImageView
+{
+	const float* data = nullptr; // top-left pixel, the red channel
+	int width = 0;
+	int height = 0;
+	std::ptrdiff_t rowStride = 0;
+	std::ptrdiff_t colStride = 0;
+	std::ptrdiff_t chanStride = 0;
+	// Position of the view in the whole frame, when only a region of
+	// the frame is fetched. Boxes and points are relative to the frame.
+	int left = 0;
+	int top = 0;
+	int frameHeight = 0; // zero if the view is the whole frame
+
+	int fullHeight() const { return frameHeight ? frameHeight : height; }
+	float at(int x, int y, int c) const {
+		return data[y * rowStride + x * colStride + c * chanStride];
+	}
+	const float* row(int y) const { return data + y * rowStride; }
+};
+
+
+// A point of the resulting geometry, layout compatible with float[3]
+// and with Nuke's Vector3
+struct Point3
+{
+	float x, y, z;
+
+	void set(float x_, float y_, float z_) { x = x_; y = y_; z = z_; }
+};
+
+typedef std::vector<Point3> Point3List;
+
+
+// A read-only array either in a vector or in a mapped file
+template <typename T>
+class ArrayView
+{
+public:
+	ArrayView() {}
+	ArrayView(const T* data, size_t size) : _data(data), _size(size) {}
+	ArrayView(const std::vector<T>& v) : _data(v.data()), _size(v.size()) {}
+
+	const T* data() const { return _data; }
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	const T& operator[](size_t i) const { return _data[i]; }
+	const T& at(size_t i) const
+	{
+		if (i >= _size)
+			throw std::out_of_range("ArrayView::at");
+		return _data[i];
+	}
+	const T* begin() const { return _data; }
+	const T* end() const { return _data + _size; }
+
+private:
+	const T* _data = nullptr;
+	size_t _size = 0;
+};
+
+typedef ArrayView<int> IndexView;
+
+
+#endif // IMAGEVIEW_H_
@@ -0,0 +1,362 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "infercache.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static const char kMagic[4] = { 'F', 'F', 'P', 'M' };
+static const uint32_t kVersion = 1;
+// the directory is trimmed below its limit, so that it isn't listed again
+// on each of the next writes
+static const float kDiskTrimFraction = 0.9f;
+
+struct CacheFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint64_t numPoints;
+};
+
+
+CachedPoints::CachedPoints(const float* data, size_t numPoints) :
+	_owned(data, data + numPoints * 3),
+	_numPoints(numPoints)
+{
+	_data = _owned.data();
+}
+
+
+CachedPoints::~CachedPoints()
+{
+	if (_map)
+		munmap(_map, _mapSize);
+}
+
+
+std::shared_ptr<const CachedPoints> CachedPoints::map(
+					const std::string& path, uint64_t key)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheFileHeader)) {
+		close(fd);
+		return nullptr;
+	}
+
+	size_t size = st.st_size;
+	void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping stays valid after closing the descriptor
+	close(fd);
+	if (addr == MAP_FAILED)
+		return nullptr;
+
+	std::shared_ptr<CachedPoints> points(new CachedPoints());
+	points->_map = addr;
+	points->_mapSize = size;
+
+	auto header = (const CacheFileHeader*)addr;
+	if (std::memcmp(header->magic, kMagic, 4) != 0 ||
+			header->version != kVersion || header->key != key ||
+			size != sizeof(CacheFileHeader) +
+				header->numPoints * 3 * sizeof(float))
+		return nullptr;
+
+	points->_numPoints = header->numPoints;
+	points->_data = (const float*)((const char*)addr +
+						sizeof(CacheFileHeader));
+	return points;
+}
+
+
+InferenceCache::InferenceCache(size_t maxBytes, const std::string& diskPath,
+						size_t maxDiskBytes) :
+	_maxBytes(maxBytes),
+	_diskPath(diskPath),
+	_maxDiskBytes(maxDiskBytes)
+{
+}
+
+
+std::shared_ptr<const CachedPoints> InferenceCache::get(uint64_t key)
+{
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _index.find(key);
+		if (it != _index.end()) {
+			_lru.splice(_lru.begin(), _lru, it->second);
+			_hits++;
+			trace::count(trace::kCacheHits);
+			return it->second->second;
+		}
+		if (_diskPath.empty()) {
+			_misses++;
+			trace::count(trace::kCacheMisses);
+			return nullptr;
+		}
+		path = filePath(key);
+	}
+
+	// page-in happens lazily, the lock isn't held for IO
+	EntryPtr entry = CachedPoints::map(path, key);
+	// the file read is the last one to be trimmed
+	if (entry)
+		utimes(path.c_str(), nullptr);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!entry) {
+		_misses++;
+		trace::count(trace::kCacheMisses);
+		return nullptr;
+	}
+	_hits++;
+	trace::count(trace::kCacheHits);
+	_diskHits++;
+	insert(key, entry);
+	return entry;
+}
+
+
+bool InferenceCache::contains(uint64_t key) const
+{
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_index.count(key))
+			return true;
+		if (_diskPath.empty())
+			return false;
+		path = filePath(key);
+	}
+	struct stat st;
+	return stat(path.c_str(), &st) == 0;
+}
+
+
+void InferenceCache::put(uint64_t key, const float* data, size_t numPoints)
+{
+	EntryPtr entry(new CachedPoints(data, numPoints));
+
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		insert(key, entry);
+		if (!_diskPath.empty())
+			path = filePath(key);
+	}
+
+	if (path.empty())
+		return;
+	if (write(path, key, data, numPoints))
+		trimDisk(sizeof(CacheFileHeader) +
+				numPoints * 3 * sizeof(float));
+	else
+		std::cout << "Couldn't write cache file " << path << "\n";
+}
+
+
+void InferenceCache::setMaxBytes(size_t maxBytes)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_maxBytes = maxBytes;
+	evict();
+}
+
+
+void InferenceCache::setDiskPath(const std::string& diskPath)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_diskPath = diskPath;
+	std::lock_guard<std::mutex> diskLock(_diskMutex);
+	_diskCounted = false;
+}
+
+
+void InferenceCache::setMaxDiskBytes(size_t maxDiskBytes)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_maxDiskBytes = maxDiskBytes;
+}
+
+
+size_t InferenceCache::hits() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _hits;
+}
+
+
+size_t InferenceCache::misses() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _misses;
+}
+
+
+size_t InferenceCache::diskHits() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _diskHits;
+}
+
+
+size_t InferenceCache::bytes() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _bytes;
+}
+
+
+std::string InferenceCache::filePath(uint64_t key) const
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "/%016llx.ffpm",
+				(unsigned long long)key);
+	return _diskPath + name;
+}
+
+
+void InferenceCache::insert(uint64_t key, const EntryPtr& entry)
+{
+	auto it = _index.find(key);
+	if (it != _index.end()) {
+		_bytes -= it->second->second->bytes();
+		_lru.erase(it->second);
+	}
+	_lru.emplace_front(key, entry);
+	_index[key] = _lru.begin();
+	_bytes += entry->bytes();
+	evict();
+}
+
+
+void InferenceCache::evict()
+{
+	// entries still referenced by the ops outlive eviction
+	while (_bytes > _maxBytes && !_lru.empty()) {
+		_bytes -= _lru.back().second->bytes();
+		_index.erase(_lru.back().first);
+		_lru.pop_back();
+	}
+}
+
+
+// The directory is listed when this process's count goes over the limit,
+// and the oldest files are removed down to a fraction of it. A file an op
+// has mapped stays valid until it's unmapped.
+void InferenceCache::trimDisk(size_t added)
+{
+	std::string dir;
+	size_t maxBytes;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		dir = _diskPath;
+		maxBytes = _maxDiskBytes;
+	}
+	if (maxBytes == 0 || dir.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(_diskMutex);
+	_diskBytes += added;
+	if (_diskCounted && _diskBytes <= maxBytes)
+		return;
+
+	struct CacheFile
+	{
+		int64_t time;	// ns
+		size_t bytes;
+		std::string path;
+	};
+	std::vector<CacheFile> files;
+	size_t total = 0;
+	DIR* d = opendir(dir.c_str());
+	if (!d)
+		return;
+	while (dirent* e = readdir(d)) {
+		std::string name = e->d_name;
+		if (name.size() < 5 ||
+				name.compare(name.size() - 5, 5, ".ffpm") != 0)
+			continue;
+		std::string path = dir + "/" + name;
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0)
+			continue;
+		int64_t time = (int64_t)st.st_mtim.tv_sec * 1000000000 +
+							st.st_mtim.tv_nsec;
+		files.push_back({ time, (size_t)st.st_size, path });
+		total += st.st_size;
+	}
+	closedir(d);
+	_diskCounted = true;
+	_diskBytes = total;
+	if (total <= maxBytes)
+		return;
+
+	std::sort(files.begin(), files.end(),
+			[](const CacheFile& a, const CacheFile& b) {
+		return a.time < b.time;
+	});
+	size_t target = maxBytes * kDiskTrimFraction;
+	for (const CacheFile& file : files) {
+		if (_diskBytes <= target)
+			break;
+		if (std::remove(file.path.c_str()) == 0)
+			_diskBytes -= file.bytes;
+	}
+}
+
+
+bool InferenceCache::write(const std::string& path, uint64_t key,
+				const float* data, size_t numPoints)
+{
+	// several processes may share the directory, the file is renamed
+	// into place once it's complete so a reader never maps a partial one
+	std::string tmpPath = path + "." + std::to_string(getpid()) + ".tmp";
+	FILE* f = std::fopen(tmpPath.c_str(), "wb");
+	if (!f)
+		return false;
+
+	CacheFileHeader header;
+	std::memcpy(header.magic, kMagic, 4);
+	header.version = kVersion;
+	header.key = key;
+	header.numPoints = numPoints;
+
+	bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1 &&
+		std::fwrite(data, sizeof(float) * 3, numPoints, f) == numPoints;
+	ok = std::fclose(f) == 0 && ok;
+
+	if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
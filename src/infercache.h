@@ -0,0 +1,105 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef INFERCACHE_H_
+#define INFERCACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Inferred points of a frame, xyz for each texel of the position map.
+// The data is either owned or memory-mapped from a cache file.
+class CachedPoints {
+public:
+	CachedPoints(const float* data, size_t numPoints);
+	~CachedPoints();
+	// returns nullptr if the file is missing or isn't a valid cache file
+	static std::shared_ptr<const CachedPoints> map(const std::string& path,
+							uint64_t key);
+	const float* data() const { return _data; }
+	size_t size() const { return _numPoints; }
+	size_t bytes() const { return _numPoints * 3 * sizeof(float); }
+private:
+	CachedPoints() {}
+	CachedPoints(const CachedPoints&) = delete;
+	CachedPoints& operator=(const CachedPoints&) = delete;
+	std::vector<float> _owned;
+	void* _map = nullptr;
+	size_t _mapSize = 0;
+	const float* _data = nullptr;
+	size_t _numPoints = 0;
+};
+
+
+// An LRU cache of inferred frames shared by all the instances of the op.
+// If the disk path is set, every inserted frame is also written into
+// <diskPath>/<key>.ffpm and misses in memory are looked up there. The
+// directory is kept under its own limit, the files least recently
+// written or read are removed first, 0 doesn't limit it.
+//
+// The file layout is a 24 bytes header
+//   char[4] magic "FFPM", uint32 version, uint64 key, uint64 numPoints
+// followed by numPoints * 3 native floats.
+class InferenceCache {
+public:
+	InferenceCache(size_t maxBytes, const std::string& diskPath = "",
+						size_t maxDiskBytes = 0);
+	std::shared_ptr<const CachedPoints> get(uint64_t key);
+	void put(uint64_t key, const float* data, size_t numPoints);
+	// whether get() would find the key, doesn't count as a hit or miss
+	bool contains(uint64_t key) const;
+	void setMaxBytes(size_t maxBytes);
+	void setDiskPath(const std::string& diskPath);
+	void setMaxDiskBytes(size_t maxDiskBytes);
+	size_t hits() const;
+	size_t misses() const;
+	size_t diskHits() const;
+	size_t bytes() const;
+private:
+	typedef std::shared_ptr<const CachedPoints> EntryPtr;
+	typedef std::pair<uint64_t, EntryPtr> Entry;
+	std::list<Entry> _lru;
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> _index;
+	size_t _maxBytes;
+	size_t _bytes = 0;
+	std::string _diskPath;
+	size_t _hits = 0;
+	size_t _misses = 0;
+	size_t _diskHits = 0;
+	mutable std::mutex _mutex;
+
+	// the directory's size as far as this process knows, other processes
+	// write into it too, it's counted again when it's over the limit
+	size_t _maxDiskBytes;
+	size_t _diskBytes = 0;
+	bool _diskCounted = false;
+	std::mutex _diskMutex;
+
+	std::string filePath(uint64_t key) const;
+	void insert(uint64_t key, const EntryPtr& entry);
+	void evict();
+	void trimDisk(size_t added);
+	static bool write(const std::string& path, uint64_t key,
+				const float* data, size_t numPoints);
+};
+
+#endif // INFERCACHE_H_
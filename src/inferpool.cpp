@@ -0,0 +1,189 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "inferpool.h"
+#include "threadbudget.h"
+#include "trace.h"
+
+#include <chrono>
+#include <iostream>
+
+
+InferencePool::InferencePool(const ModelConfig& config,
+				int numSessions, int batchSize) :
+	_config(config),
+	_batchSize(batchSize)
+{
+	setSize(numSessions);
+}
+
+
+InferencePool::~InferencePool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_queued.notify_all();
+	for (auto& thread : _threads)
+		thread.join();
+}
+
+
+void InferencePool::setSize(int numSessions)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_started)
+		_numSessions = numSessions > 0 ? numSessions : 1;
+}
+
+
+int InferencePool::size() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _numSessions;
+}
+
+
+double InferencePool::loadSeconds() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _loadSeconds;
+}
+
+
+size_t InferencePool::loadBytes() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _loadBytes;
+}
+
+
+// called with _mutex held
+void InferencePool::start()
+{
+	_started = true;
+	for (int i = 0; i < _numSessions; i++)
+		_threads.emplace_back(&InferencePool::run, this);
+}
+
+
+void InferencePool::load(int warmUpResolution)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_started)
+		return;
+	_warmUpResolution = warmUpResolution;
+	start();
+}
+
+
+std::future<FloatTensor> InferencePool::submit(const FloatTensor& img)
+{
+	std::unique_ptr<Request> request(new Request);
+	request->img = img;
+	std::future<FloatTensor> result = request->result.get_future();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_started)
+			start();
+		_queue.push_back(std::move(request));
+	}
+	_queued.notify_one();
+	return result;
+}
+
+
+FloatTensor InferencePool::infer(const FloatTensor& img)
+{
+	TRACE_SCOPE("pool infer");
+	return submit(img).get();
+}
+
+
+void InferencePool::run()
+{
+	// the runtime's threads are started while loading, they inherit
+	// the cores of this one
+	ThreadBudget budget = threadBudget();
+	pinThread(budget);
+	ModelConfig config = _config;
+	config.threads = budget.threads;
+	config.sharedSessions = _numSessions;
+
+	std::unique_ptr<PRNet> net;
+	{
+		// one at a time, so the growth of the process is of the
+		// sessions alone
+		std::lock_guard<std::mutex> load(_loadMutex);
+		size_t before = trace::residentBytes();
+		auto start = std::chrono::steady_clock::now();
+		net.reset(new PRNet(config, _batchSize));
+		double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		size_t after = trace::residentBytes();
+		size_t bytes = after > before ? after - before : 0;
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		_loadSeconds += seconds;
+		_loadBytes += bytes;
+		std::cout << "Session loaded in " << seconds << " s, "
+			<< (bytes >> 20) << " MB\n";
+	}
+
+	// _warmUpResolution is only set before the threads are started
+	if (_warmUpResolution > 0) {
+		TRACE_SCOPE("warm up");
+		FloatTensor blank(1, _warmUpResolution, _warmUpResolution, 3);
+		blank.setZero();
+		net->infer(blank);
+	}
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_queued.wait(lock, [&] { return _stop || !_queue.empty(); });
+		if (_stop)
+			break;
+
+		// as many queued requests as fit into the batch
+		std::vector<std::unique_ptr<Request>> requests;
+		int64_t rows = 0;
+		while (!_queue.empty()) {
+			int64_t n = _queue.front()->img.dimSize(0);
+			if (!requests.empty() && rows + n > _batchSize)
+				break;
+			rows += n;
+			requests.push_back(std::move(_queue.front()));
+			_queue.pop_front();
+		}
+		lock.unlock();
+
+		std::vector<FloatTensor> imgs;
+		for (auto& request : requests)
+			imgs.push_back(request->img);
+		std::vector<FloatTensor> outputs = net->inferBatch(imgs);
+		for (size_t i = 0; i < requests.size(); i++)
+			requests[i]->result.set_value(outputs[i]);
+
+		lock.lock();
+	}
+
+	// the requests left are failed rather than left hanging
+	while (!_queue.empty()) {
+		_queue.front()->result.set_value(FloatTensor());
+		_queue.pop_front();
+	}
+}
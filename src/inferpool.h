@@ -0,0 +1,89 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef INFERPOOL_H_
+#define INFERPOOL_H_
+
+#include "prnet.h"
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+
+// Process-wide inference on a bounded number of sessions, each holds
+// its own copy of the weights. Requests from any thread are queued and
+// a session's thread takes as many of them as fit into a batch and
+// runs them at once. The sessions are loaded on the first request and
+// share the process' thread budget, see threadbudget.h.
+class InferencePool {
+public:
+	InferencePool(const ModelConfig& config,
+			int numSessions = 1,
+			int batchSize = kDefaultBatchSize);
+	~InferencePool();
+
+	std::future<FloatTensor> submit(const FloatTensor& img);
+	// Blocks until the request is done, an empty tensor if it's failed
+	FloatTensor infer(const FloatTensor& img);
+
+	// Starts loading the sessions without waiting for a request. With a
+	// resolution, each session also runs a blank crop of it once, the
+	// first run is much slower than the following ones.
+	void load(int warmUpResolution = 0);
+	// Takes effect only before the sessions are loaded
+	void setSize(int numSessions);
+	int size() const;
+	// The requested model, the sessions may fall back to another
+	// variant if it's missing
+	const ModelConfig& config() const { return _config; }
+	// how long loading the sessions took and how much the process
+	// grew by, zeros until they are loaded
+	double loadSeconds() const;
+	size_t loadBytes() const;
+
+private:
+	InferencePool(const InferencePool&) = delete;
+	InferencePool& operator=(const InferencePool&) = delete;
+
+	struct Request
+	{
+		FloatTensor img;
+		std::promise<FloatTensor> result;
+	};
+
+	const ModelConfig _config;
+	int _numSessions;
+	int _batchSize;
+	std::deque<std::unique_ptr<Request>> _queue;
+	std::vector<std::thread> _threads;
+	mutable std::mutex _mutex;
+	std::mutex _loadMutex;
+	std::condition_variable _queued;
+	bool _started = false;
+	int _warmUpResolution = 0;
+	bool _stop = false;
+	double _loadSeconds = 0;
+	size_t _loadBytes = 0;
+
+	void start();
+	void run();
+};
+
+
+#endif // INFERPOOL_H_
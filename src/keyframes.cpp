@@ -0,0 +1,93 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "keyframes.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+float keyPointsMotion(const Point3List& a, const Point3List& b,
+				IndexView kptIndices)
+{
+	float minX = 1e9f, minY = 1e9f, maxX = -1e9f, maxY = -1e9f;
+	float maxDist = 0;
+	for (int i : kptIndices) {
+		const Point3& p = a[i];
+		const Point3& q = b[i];
+		minX = std::min(minX, p.x);
+		maxX = std::max(maxX, p.x);
+		minY = std::min(minY, p.y);
+		maxY = std::max(maxY, p.y);
+		maxDist = std::max(maxDist, std::hypot(q.x - p.x, q.y - p.y));
+	}
+	float size = std::hypot(maxX - minX, maxY - minY);
+	return size > 0 ? maxDist / size : 0;
+}
+
+
+// rounds towards minus infinity, frames may be negative
+static int keyframeBefore(int frame, int interval)
+{
+	int k = frame / interval * interval;
+	return k > frame ? k - interval : k;
+}
+
+
+bool interpolateFrame(int frame, int interval, float maxMotion,
+			IndexView kptIndices,
+			const FrameInference& infer, Point3List& points)
+{
+	int a = keyframeBefore(frame, interval);
+	if (interval < 2 || a == frame)
+		return infer(frame, points);
+
+	int b = a + interval;
+	Point3List pa, pb;
+	if (!infer(a, pa) || !infer(b, pb) || pa.size() != pb.size())
+		return false;
+
+	// the frame is always strictly between a and b, so the bisection
+	// ends up on it at the latest
+	while (keyPointsMotion(pa, pb, kptIndices) > maxMotion) {
+		int m = a + (b - a) / 2;
+		if (m == frame)
+			return infer(frame, points);
+		Point3List pm;
+		if (!infer(m, pm) || pm.size() != pa.size())
+			return false;
+		if (frame < m) {
+			b = m;
+			pb.swap(pm);
+		} else {
+			a = m;
+			pa.swap(pm);
+		}
+	}
+
+	TRACE_SCOPE("interpolateFrame");
+	float t = (float)(frame - a) / (b - a);
+	points.resize(pa.size());
+	for (size_t i = 0; i < pa.size(); i++) {
+		const Point3& p = pa[i];
+		const Point3& q = pb[i];
+		points[i].set(p.x + t * (q.x - p.x), p.y + t * (q.y - p.y),
+						p.z + t * (q.z - p.z));
+	}
+	trace::count(trace::kInterpolatedFrames);
+	return true;
+}
@@ -0,0 +1,44 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef KEYFRAMES_H_
+#define KEYFRAMES_H_
+
+#include "imageview.h"
+#include <functional>
+#include <vector>
+
+
+// Gets the points of a frame by a real inference, false if it's failed
+typedef std::function<bool(int frame, Point3List& points)> FrameInference;
+
+// How far the key points move between two inferred frames, the largest
+// displacement relative to the diagonal of the key points' box
+float keyPointsMotion(const Point3List& a, const Point3List& b,
+				IndexView kptIndices);
+
+// Fills a frame in between the keyframes every "interval" frames by
+// interpolating the keyframes' points. Where the key points move more
+// than maxMotion, the frame in the middle is inferred as well and so on
+// down to single frames, i.e. fast motion ends up inferred on each frame.
+// Keyframes are requested from infer() again for every in-between frame,
+// it should cache them. Returns false if a keyframe couldn't be inferred.
+bool interpolateFrame(int frame, int interval, float maxMotion,
+			IndexView kptIndices,
+			const FrameInference& infer, Point3List& points);
+
+
+#endif // KEYFRAMES_H_
@@ -0,0 +1,72 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef LAZYLOAD_H_
+#define LAZYLOAD_H_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+
+
+// Loads an object on a thread of its own when it's first needed instead
+// of at the library's load. All the callers wait for the same load, the
+// loading function may report its progress from 0 to 1.
+template <typename T>
+class LazyLoad {
+public:
+	typedef std::function<T*(std::atomic<float>& progress)> Load;
+
+	LazyLoad(const Load& load) : _load(load) {}
+
+	// Starts the loading if it hasn't been started, doesn't block
+	void start()
+	{
+		std::call_once(_once, [this] {
+			_future = std::async(std::launch::async, [this] {
+				return std::shared_ptr<T>(_load(_progress));
+			}).share();
+		});
+	}
+
+	bool ready()
+	{
+		start();
+		return _future.wait_for(std::chrono::seconds(0)) ==
+						std::future_status::ready;
+	}
+
+	// Blocks until the object is loaded
+	T& get()
+	{
+		start();
+		return *_future.get();
+	}
+
+	float progress() const { return _progress; }
+
+private:
+	Load _load;
+	std::once_flag _once;
+	std::shared_future<std::shared_ptr<T>> _future;
+	std::atomic<float> _progress{0};
+};
+
+
+#endif // LAZYLOAD_H_
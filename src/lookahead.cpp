@@ -0,0 +1,197 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "lookahead.h"
+#include "trace.h"
+
+#include <algorithm>
+
+
+LookAhead::LookAhead(const CreateJob& create,
+			const std::vector<Stage>& stages) :
+	_create(create),
+	_stages(stages),
+	_queues(stages.size())
+{
+	for (size_t i = 0; i < _stages.size(); i++)
+		_threads.emplace_back(&LookAhead::run, this, i);
+}
+
+
+LookAhead::~LookAhead()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_queued.notify_all();
+	for (auto& thread : _threads)
+		thread.join();
+}
+
+
+void LookAhead::seek(int frame, int depth)
+{
+	std::vector<int> wanted;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (frame != _lastFrame)
+			_direction = frame > _lastFrame ? 1 : -1;
+		_lastFrame = frame;
+
+		for (int i = 1; i <= depth; i++)
+			wanted.push_back(frame + i * _direction);
+
+		std::vector<LookAheadJobPtr> stale;
+		for (auto& item : _jobs) {
+			if (item.first != frame &&
+				std::find(wanted.begin(), wanted.end(),
+					item.first) == wanted.end())
+				stale.push_back(item.second);
+		}
+		for (auto& job : stale)
+			cancelLocked(job);
+
+		wanted.erase(std::remove_if(wanted.begin(), wanted.end(),
+			[&](int f) { return running(f); }),
+			wanted.end());
+	}
+	if (wanted.empty())
+		return;
+
+	// the job is created without the lock, it may take a while, and
+	// only the nearest one the creation doesn't turn down, it holds up
+	// the caller
+	LookAheadJobPtr job;
+	for (int f : wanted) {
+		job = _create(f);
+		if (job) {
+			job->frame = f;
+			break;
+		}
+	}
+	if (!job)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (running(job->frame))
+			return;
+		_jobs[job->frame] = job;
+		_queues[0].push_back(job);
+	}
+	_queued.notify_all();
+}
+
+
+bool LookAhead::wait(int frame)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	auto it = _jobs.find(frame);
+	if (it == _jobs.end())
+		return false;
+	// it might be queued behind the frames it's just scrubbed away from
+	LookAheadJobPtr job = it->second;
+	auto& queue = _queues[0];
+	auto queued = std::find(queue.begin(), queue.end(), job);
+	if (queued != queue.end()) {
+		queue.erase(queued);
+		queue.push_front(job);
+	}
+	_finished.wait(lock, [&] {
+		auto it = _jobs.find(frame);
+		return it == _jobs.end() || it->second != job;
+	});
+	return true;
+}
+
+
+void LookAhead::cancel()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<LookAheadJobPtr> jobs;
+	for (auto& item : _jobs)
+		jobs.push_back(item.second);
+	for (auto& job : jobs)
+		cancelLocked(job);
+}
+
+
+// a cancelled job may still be running, a new one can replace it
+bool LookAhead::running(int frame) const
+{
+	auto it = _jobs.find(frame);
+	return it != _jobs.end() && !it->second->cancelled;
+}
+
+
+void LookAhead::cancelLocked(const LookAheadJobPtr& job)
+{
+	if (job->cancelled)
+		return;
+	job->cancelled = true;
+	trace::count(trace::kLookAheadCancelled);
+	// a queued job is dropped right away, a running one when its stage
+	// returns
+	for (auto& queue : _queues) {
+		auto it = std::find(queue.begin(), queue.end(), job);
+		if (it != queue.end()) {
+			queue.erase(it);
+			_jobs.erase(job->frame);
+			_finished.notify_all();
+			return;
+		}
+	}
+}
+
+
+void LookAhead::finish(const LookAheadJobPtr& job)
+{
+	auto it = _jobs.find(job->frame);
+	if (it != _jobs.end() && it->second == job)
+		_jobs.erase(it);
+	_finished.notify_all();
+}
+
+
+void LookAhead::run(size_t stage)
+{
+	bool last = stage + 1 == _stages.size();
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_queued.wait(lock, [&] {
+			return _stop || !_queues[stage].empty();
+		});
+		if (_stop)
+			return;
+
+		LookAheadJobPtr job = _queues[stage].front();
+		_queues[stage].pop_front();
+
+		lock.unlock();
+		bool ok = _stages[stage](*job);
+		lock.lock();
+
+		if (!ok || job->cancelled || last) {
+			if (ok && last && !job->cancelled)
+				trace::count(trace::kLookAheadFitted);
+			finish(job);
+			continue;
+		}
+		_queues[stage + 1].push_back(job);
+		_queued.notify_all();
+	}
+}
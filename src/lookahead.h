@@ -0,0 +1,98 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef LOOKAHEAD_H_
+#define LOOKAHEAD_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// A frame passing through the stages, the stages derive from it
+// to carry their data from one to the next
+struct LookAheadJob
+{
+	virtual ~LookAheadJob() {}
+	int frame = 0;
+	std::atomic<bool> cancelled{false};
+};
+
+typedef std::shared_ptr<LookAheadJob> LookAheadJobPtr;
+
+
+// Fits frames ahead of the playhead in the background. Every stage has
+// its own thread, so while one frame is in the session the next one is
+// being detected. Whatever must happen on the calling thread, e.g. pulling
+// from Nuke's ops, is done synchronously when the job is created, so a
+// seek creates one job at most and the window fills up as the playhead
+// moves. The stages store the results themselves, e.g. into the inference
+// cache.
+class LookAhead {
+public:
+	// Makes a job for a frame, it's called on the thread calling
+	// seek(), null if the frame needn't be fitted
+	typedef std::function<LookAheadJobPtr(int frame)> CreateJob;
+	// Returns false if the job should go no further
+	typedef std::function<bool(LookAheadJob& job)> Stage;
+
+	LookAhead(const CreateJob& create, const std::vector<Stage>& stages);
+	~LookAhead();
+
+	// The playhead has moved to the frame: queues the nearest of the
+	// "depth" frames after it in the direction it moves which has no job
+	// yet and which the creation doesn't turn down, and cancels the jobs
+	// outside of that window, e.g. after scrubbing. The frame itself is
+	// left to the caller, though a job already running for it isn't
+	// cancelled.
+	void seek(int frame, int depth);
+	// Waits until the frame's job is done if there's one,
+	// returns false if there isn't
+	bool wait(int frame);
+	// Cancels all the jobs, the running stages finish their job first
+	void cancel();
+
+private:
+	LookAhead(const LookAhead&) = delete;
+	LookAhead& operator=(const LookAhead&) = delete;
+
+	CreateJob _create;
+	std::vector<Stage> _stages;
+	std::vector<std::deque<LookAheadJobPtr>> _queues;
+	// every job either queued or being run by a stage
+	std::map<int, LookAheadJobPtr> _jobs;
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _queued;
+	std::condition_variable _finished;
+	bool _stop = false;
+	int _lastFrame = 0;
+	int _direction = 1;
+
+	bool running(int frame) const;
+	void run(size_t stage);
+	void finish(const LookAheadJobPtr& job);
+	void cancelLocked(const LookAheadJobPtr& job);
+};
+
+
+#endif // LOOKAHEAD_H_
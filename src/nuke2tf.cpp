@@ -15,13 +15,32 @@
  * ************************************************************************/
 
 #include "nuke2tf.h"
+#include "srgb.h"
+#include "threadbudget.h"
+#include "trace.h"
+#include "warp.h"
 
 #include <dlib/image_transforms.h>
-#include <fstream>
+#include <algorithm>
 #include <cmath>
+#include <iostream>
 
 using namespace dlib;
-using namespace tensorflow;
+
+
+// The smallest faces the detectors find, the sides of their windows
+static const int kHogWindow = 80;
+static const int kCnnWindow = 40;
+// Without a minimal face size the faces are expected to be larger than
+// this part of the frame's height, e.g. 180 pixels in HD
+static const int kAutoFaceFraction = 6;
+// Upsampling quadruples the detection's time each time
+static const unsigned kMaxUpsample = 2;
+
+static const char* kDetectorNames[kNumDetectors] = { "hog", "cnn" };
+
+// Fewer points are extracted on the calling thread
+static const long kParallelPoints = 4096;
 
 
 Nuke2TensorFlow::Nuke2TensorFlow(int resolution)
@@ -33,144 +52,313 @@ Nuke2TensorFlow::Nuke2TensorFlow(int resolution)
 		{ 0, _resolution - 1},
 		{ _resolution - 1, 0},
 	};
-	_points.resize(_resolution * _resolution);
-	_planeHeight = 0;
 }
 
 
-Nuke2TensorFlow::StaticData::StaticData(const std::string& detectorModelPath,
-			const std::string& trianglesPath,
-			const std::string& faceIndicesPath,
-			const std::string& kptIndicesPath,
-			int resolution)
+const char* detectorName(DetectorType type)
 {
+	return kDetectorNames[type];
+}
+
+
+bool parseDetector(const std::string& name, DetectorType& type)
+{
+	for (int i = 0; i < kNumDetectors; i++) {
+		if (name == kDetectorNames[i]) {
+			type = (DetectorType)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// called with _mutex held, a model which has failed isn't retried
+bool CnnFaceDetector::load()
+{
+	if (_net || _failed)
+		return _net != nullptr;
+	TRACE_SCOPE("load detector");
 	std::cout << "Loading the detector model...\n";
-	deserialize(detectorModelPath) >> net;
-
-	std::cout << "Loading the indices data...\n";
-	readIndices(faceIndicesPath, _faceIndices);
-	for (int i = 0; i < _faceIndices.size(); i++)
-		_face2all[i] = _faceIndices[i];
-
-	std::vector<int> kptIndices2d;
-	readIndices(kptIndicesPath, kptIndices2d);
-	int size = kptIndices2d.size() / 2;
-	for (int i = 0; i < size; i++) {
-		int x = kptIndices2d.at(i + size);
-		int y = kptIndices2d.at(i);
-		_kptIndices.push_back(x * resolution + y);
+	std::unique_ptr<net_type> net(new net_type);
+	try {
+		deserialize(_modelPath) >> *net;
+	} catch (std::exception& e) {
+		std::cout << "Couldn't load the detector model, HOG is used: "
+			<< e.what() << "\n";
+		_failed = true;
+		return false;
 	}
-	readIndices(trianglesPath, _triIndices);
+	_net = std::move(net);
+	return true;
+}
 
-	std::cout << "Generating default points and UVs...\n";
-	int numPoints = resolution * resolution;
-	_uvs.resize(numPoints);
-	_defaultPoints.resize(numPoints);
 
-	for (int i = 0; i < resolution; i++) {
-		for (int j = 0; j < resolution; j++) {
-			int i_flat = i * resolution + j;
+bool CnnFaceDetector::loaded() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _net != nullptr;
+}
 
-			_defaultPoints.at(i_flat).set(i * 2, j * 2, 0);
 
-			_uvs[i_flat] = DD::Image::Vector3(
-				(float)j / (float)resolution,
-				1 - (float)i / (float)resolution,
-				0.0
-			);
+bool CnnFaceDetector::detect(const matrix<rgb_pixel>& img,
+				std::vector<dlib::rectangle>& faces)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!load())
+		return false;
+	TRACE_SCOPE("cnn detect");
+	faces.clear();
+	for (auto& det : (*_net)(img))
+		faces.push_back(det.rect);
+	return true;
+}
 
-		}
+
+// The CNN detector is loaded on the first detection with it
+Nuke2TensorFlow::StaticData::StaticData(const std::string& detectorModelPath,
+			const std::string& trianglesPath,
+			const std::string& faceIndicesPath,
+			const std::string& kptIndicesPath,
+			int resolution,
+			const std::string& assetPath,
+			std::atomic<float>* progress) :
+	cnnDetector(detectorModelPath)
+{
+	TRACE_SCOPE("load static data");
+	// the assets are most of it, the layouts and the topologies the rest
+	auto report = [&](float fraction) {
+		if (progress)
+			*progress = fraction;
+	};
+	if (assetPath.empty() || !_assets.map(assetPath, resolution)) {
+		std::cout << "Loading the indices data...\n";
+		_assets.loadText(trianglesPath, faceIndicesPath,
+				kptIndicesPath, resolution,
+				[&](float fraction) {
+					report(fraction * 0.7f);
+				});
 	}
+	report(0.7f);
 
 	_endList = { 16, 21, 26, 41, 47, 30, 35, 67 };
+	makeLayouts(resolution);
+	report(0.85f);
+	makeTopologies();
+	report(1.0f);
 }
 
 
-void Nuke2TensorFlow::StaticData::readIndices(const std::string& path,
-						std::vector<int>& indices)
+void Nuke2TensorFlow::StaticData::makeLayouts(int resolution)
 {
-	std::fstream ifs;
-	ifs.open(path);
-	if (!ifs) {
-                std::cout << "Error reading indices file.\n";
-                return;
-        }
-	double index;
-	while(ifs >> index) {
-		indices.push_back((int)index);
+	IndexView face = _assets.faceIndices();
+	IndexView kpts = _assets.kptIndices();
+
+	std::vector<int> positions(resolution * resolution, -1);
+	for (size_t i = 0; i < face.size(); i++)
+		positions.at(face[i]) = i;
+
+	// the key points are all within the face's mask of PRNet's data,
+	// others are carried after the face's points just in case
+	std::vector<int> extra;
+	_faceKptPositions.clear();
+	_kptPositions.clear();
+	for (size_t i = 0; i < kpts.size(); i++) {
+		int position = positions.at(kpts[i]);
+		if (position < 0) {
+			position = face.size() + extra.size();
+			extra.push_back(kpts[i]);
+		}
+		_faceKptPositions.push_back(position);
+		_kptPositions.push_back(i);
+	}
+
+	_faceLayoutIndices.clear();
+	if (extra.empty()) {
+		// the asset's indices, shared by the processes mapping it
+		_faceLayout.indices = face;
+	} else {
+		_faceLayoutIndices.assign(face.begin(), face.end());
+		_faceLayoutIndices.insert(_faceLayoutIndices.end(),
+						extra.begin(), extra.end());
+		_faceLayout.indices = _faceLayoutIndices;
 	}
-	ifs.clear();
-	ifs.close();
+	_faceLayout.kptIndices = _faceKptPositions;
+	_kptLayout.indices = kpts;
+	_kptLayout.kptIndices = _kptPositions;
 }
 
 
-unsigned char Nuke2TensorFlow::linear2srgb(float c)
+void Nuke2TensorFlow::StaticData::makeTopologies()
 {
-	if (c > 0.0031308)
-		c = 1.055 * (std::pow(c, (1.0 / 2.4))) - 0.055;
-	else
-		c = 12.92 * c;
-	return clamp((int)(c * 255), 0, 255);
+	// the face's layout is in the order the triangles index, they're
+	// reversed for Nuke's winding
+	IndexView tris = _assets.triIndices();
+	_meshTopology.triangles.clear();
+	_meshTopology.triangles.reserve(tris.size());
+	for (size_t i = 2; i < tris.size(); i += 3) {
+		_meshTopology.triangles.push_back(tris[i]);
+		_meshTopology.triangles.push_back(tris[i - 1]);
+		_meshTopology.triangles.push_back(tris[i - 2]);
+	}
+
+	// not the key points the face's layout may carry after its own
+	_cloudTopology.points.resize(_assets.faceIndices().size());
+	for (size_t i = 0; i < _cloudTopology.points.size(); i++)
+		_cloudTopology.points[i] = i;
+
+	// a line from each key point to the next one except for the ends
+	// of the shapes, the shapes starting from 41 are closed
+	int numKpts = _kptLayout.indices.size();
+	_kptTopology.points.resize(numKpts);
+	_kptTopology.lines.clear();
+	int start = 0;
+	for (int i = 0; i < numKpts; i++) {
+		_kptTopology.points[i] = i;
+		if (_endList.find(i) == _endList.end()) {
+			if (i + 1 < numKpts) {
+				_kptTopology.lines.push_back(i);
+				_kptTopology.lines.push_back(i + 1);
+			}
+			continue;
+		}
+		if (i >= 41) {
+			_kptTopology.lines.push_back(i);
+			_kptTopology.lines.push_back(start);
+		}
+		start = i + 1;
+	}
 }
 
 
-void Nuke2TensorFlow::extractDataFromTensor(Tensor& tensor)
+void Nuke2TensorFlow::extractDataFromTensor(const FloatTensor& tensor,
+					const FaceCrop& crop,
+					const PointLayout& layout,
+					Point3* dst,
+					int batchIndex) const
 {
-	auto et = tensor.flat_inner_dims<float, 3>();
+	TRACE_SCOPE("extractDataFromTensor");
+	IndexView indices = layout.indices;
+	const float* et = tensor.item(batchIndex);
 	
 	// this coefficient 1.1, and the coefficients below for expanding
 	// a facial bounding box were taken from PRNet's Python code,
 	// I've no idea whether they're empirical or have a precise meaning
 	float mult = (float)_resolution * 1.1;
-	float frac = mult / _pointTransform.get_m()(0, 0);
+	float frac = mult / crop.transform.get_m()(0, 0);
 
-	_pointTransform = inv(_pointTransform);
-	
-	parallel_for(size_t(0), _resolution, [&](size_t i) {
-	    for (int j = 0; j < _resolution; j++) {
-		float x = et(i, j, 0) * mult;
-		float y = et(i, j, 1) * mult;
-		float z = et(i, j, 2) * frac;
-
-		vector<double, 2> v = {x, y};
-		v = _pointTransform({x, y});
-
-		x = v(0);
-		y = _planeHeight - 1 - v(1);
-		
-		_points.at(i * _resolution + j).set(x, y, z);
-	    }
+	auto invTransform = inv(crop.transform);
+
+	long n = indices.empty() ?
+		(long)_resolution * _resolution : (long)indices.size();
+
+	// only the texels of the indices if there are any
+	auto extract = [&](long first, long last) {
+		for (long k = first; k < last; k++) {
+			const float* p = et + (indices.empty() ?
+						k : indices[k]) * 3;
+			float x = p[0] * mult;
+			float y = p[1] * mult;
+			float z = p[2] * frac;
+
+			vector<double, 2> v = invTransform({x, y});
+
+			x = v(0);
+			y = crop.planeHeight - 1 - v(1);
+
+			dst[k].set(x, y, z);
+		}
+	};
+	// the key points alone aren't worth waking the pool up
+	if (n < kParallelPoints)
+		extract(0, n);
+	else
+		parallel_for_blocked(hostThreadPool(), 0, n, extract);
+}
+
+
+void Nuke2TensorFlow::extractDataFromTensor(const FloatTensor& tensor,
+					const FaceCrop& crop,
+					Point3List& points,
+					IndexView indices,
+					int batchIndex) const
+{
+	PointLayout layout{indices};
+	points.resize(layout.size(_resolution));
+	extractDataFromTensor(tensor, crop, layout, points.data(),
+							batchIndex);
+}
+
+
+void Nuke2TensorFlow::extractDataFromTensor(const FloatTensor& tensor,
+						IndexView indices)
+{
+	extractDataFromTensor(tensor, _crop, _points, indices);
+}
+
+
+void Nuke2TensorFlow::plane2img(const ImageView& plane,
+				const dlib::rectangle& region,
+				matrix<rgb_pixel>& img)
+{
+	TRACE_SCOPE("plane2img");
+	int h = region.height(), w = region.width();
+	int x = region.left(), y = region.top();
+
+	img.set_size(h, w);
+	if (h == 0 || w == 0)
+		return;
+
+	static_assert(sizeof(rgb_pixel) == 3, "rgb_pixel isn't packed");
+
+	// a channel of a row at a time straight into the pixels' bytes
+	parallel_for(hostThreadPool(), size_t(0), h, [&](size_t i) {
+		const float* src = plane.row(y + i) + x * plane.colStride;
+		unsigned char* dst = &img(i, 0).red;
+		for (int c = 0; c < 3; c++) {
+			srgb::linear2srgbRow(src + c * plane.chanStride,
+					plane.colStride, dst + c, 3, w);
+		}
 	});
 }
 
 
-void Nuke2TensorFlow::plane2img(const DD::Image::ImagePlane& plane,
+void Nuke2TensorFlow::plane2proxy(const ImageView& plane, int factor,
 						matrix<rgb_pixel>& img)
 {
-	auto ipBox = plane.bounds();
-	int x = ipBox.x(), t = ipBox.t(), r = ipBox.r(),
-	    y = ipBox.y(), h = ipBox.h(), w = ipBox.w();
-	_planeHeight = (float)h;
-	_planeWidth = (float)w;
+	TRACE_SCOPE("plane2proxy");
+	int h = plane.height / factor, w = plane.width / factor;
+	float norm = 1.0f / (factor * factor);
 
 	img.set_size(h, w);
 
-	parallel_for(size_t(1), h + 1, [&](size_t i) {
+	// box filter, only the averages go through the sRGB curve
+	parallel_for(hostThreadPool(), size_t(0), h, [&](size_t i) {
 		for (int j = 0; j < w; j++) {
-			unsigned char r = linear2srgb(plane.at(x + j, t - i, 0));
-			unsigned char g = linear2srgb(plane.at(x + j, t - i, 1));
-			unsigned char b = linear2srgb(plane.at(x + j, t - i, 2));
-			img(i - 1, j) = rgb_pixel(r, g, b);
+			float sum[3] = { 0, 0, 0 };
+			for (int dy = 0; dy < factor; dy++) {
+				for (int dx = 0; dx < factor; dx++) {
+					int x = j * factor + dx;
+					int y = i * factor + dy;
+					for (int c = 0; c < 3; c++)
+						sum[c] += plane.at(x, y, c);
+				}
+			}
+			img(i, j) = rgb_pixel(
+					srgb::linear2srgb(sum[0] * norm),
+					srgb::linear2srgb(sum[1] * norm),
+					srgb::linear2srgb(sum[2] * norm));
 		}
 	});
 }
 
 
-Tensor Nuke2TensorFlow::extractFaceTensor(const matrix<rgb_pixel>& inImg,
+void Nuke2TensorFlow::extractFaceTensor(const ImageView& plane,
 					int l, int r, int t, int b,
-					bool detected)
+					bool detected, FloatTensor& tensor,
+					int batchIndex, FaceCrop& crop)
 {
-	//std::cout << "Processing image data for TensorFlow...\n";
+	TRACE_SCOPE("extractFaceTensor");
 	int c[2] = { r - (r - l) / 2, b - (b - t) / 2 };
 	int bboxSize = (r - l + b - t) / 2;
 
@@ -188,71 +376,216 @@ Tensor Nuke2TensorFlow::extractFaceTensor(const matrix<rgb_pixel>& inImg,
 		{ c[0] + halfSize, c[1] - halfSize },
 	};
 
-	matrix<rgb_pixel> outImg;
-	outImg.set_size(_resolution, _resolution);
+	crop.face = dlib::rectangle(l, t, r, b);
+	crop.transform = find_affine_transform(srcPoints, _destPoints);
+	auto crop2frame = inv(crop.transform);
+
+	// resampled straight from the plane into the tensor, the map
+	// goes from the crop's pixels to the view's
+	CropMap map;
+	map.m00 = crop2frame.get_m()(0, 0);
+	map.m01 = crop2frame.get_m()(0, 1);
+	map.m10 = crop2frame.get_m()(1, 0);
+	map.m11 = crop2frame.get_m()(1, 1);
+	map.b0 = crop2frame.get_b().x() - plane.left;
+	map.b1 = crop2frame.get_b().y() - plane.top;
+
+	float* dst = tensor.item(batchIndex);
+	parallel_for(hostThreadPool(), size_t(0), _resolution, [&](size_t y) {
+		warpRow(plane, map, y, _resolution,
+				dst + y * _resolution * 3);
+	});
+}
 
-	_pointTransform = find_affine_transform(srcPoints, _destPoints);
-	transform_image(inImg, outImg,
-				interpolate_quadratic(), inv(_pointTransform));
 
-	return img2Tensor(outImg);
+void Nuke2TensorFlow::setDetector(const DetectorConfig& config,
+					CnnFaceDetector* cnn)
+{
+	_detectorConfig = config;
+	_cnn = cnn;
 }
 
 
-Tensor Nuke2TensorFlow::img2Tensor(const matrix<rgb_pixel>& img)
+void Nuke2TensorFlow::detectionScale(const DetectorConfig& config,
+				int frameHeight, int& factor,
+				unsigned& upsample)
 {
-	Tensor tensor(DT_FLOAT, TensorShape({1, _resolution, _resolution, 3}));
-	auto tensorMapped = tensor.tensor<float, 4>();
-
-	parallel_for(size_t(0), _resolution, [&](size_t y) {
-	    for (int x = 0; x < _resolution; ++x) {
-		rgb_pixel p = img(y, x);
-		tensorMapped(0, y, x, 0) = (float)p.red / 255.;
-		tensorMapped(0, y, x, 1) = (float)p.green / 255.;
-		tensorMapped(0, y, x, 2) = (float)p.blue / 255.;
-	    }
-	});
-	return tensor;
+	int window = config.type == kCnnDetector ? kCnnWindow : kHogWindow;
+	int minFace = config.minFaceSize > 0 ? config.minFaceSize :
+				frameHeight / kAutoFaceFraction;
+	// the proxy of a frame is still larger than the window
+	factor = std::max(1, std::min(minFace / window,
+					frameHeight / window));
+	upsample = 0;
+	while (upsample < kMaxUpsample && (minFace << upsample) < window)
+		upsample++;
 }
 
 
-Tensor Nuke2TensorFlow::imagePlane2Tensor(const DD::Image::ImagePlane& plane,
-					const DD::Image::Box& userBBox,
-					bool useDetector)
+// The scale is of the whole frame, a region of it is detected on at the
+// same scale as the frame
+bool Nuke2TensorFlow::detect(const ImageView& plane,
+				std::vector<dlib::rectangle>& faces)
 {
-	matrix<rgb_pixel> img;
-	plane2img(plane, img);
+	TRACE_SCOPE("detect");
+	int factor;
+	unsigned upsample;
+	detectionScale(_detectorConfig, plane.fullHeight(), factor, upsample);
+
+	// a box filtered proxy instead of the whole frame for large faces
+	matrix<rgb_pixel> imgP;
+	if (factor > 1)
+		plane2proxy(plane, factor, imgP);
+	else
+		plane2img(plane, dlib::rectangle(0, 0, plane.width - 1,
+						plane.height - 1), imgP);
+	pyramid_down<2> pyr;
+	for (unsigned i = 0; i < upsample; i++)
+		pyramid_up(imgP, pyr);
+
+	std::vector<dlib::rectangle> dets;
+	bool cnn = _detectorConfig.type == kCnnDetector && _cnn;
+	if (!cnn || !_cnn->detect(imgP, dets))
+		dets = _detector(imgP);
+	for (auto& det : dets)
+		det = pyr.rect_down(det, upsample);
+
+	if (dets.size() < 1) {
+		trace::count(trace::kDetectorMisses);
+		return false;
+	}
+	faces.clear();
+	for (auto& det : dets) {
+		faces.push_back(dlib::rectangle(
+				det.left() * factor + plane.left,
+				det.top() * factor + plane.top,
+				(det.right() + 1) * factor - 1 + plane.left,
+				(det.bottom() + 1) * factor - 1 + plane.top));
+	}
+	return true;
+}
+
+
+bool Nuke2TensorFlow::plane2Tensor(const ImageView& plane,
+				const dlib::rectangle& userBBox,
+				bool useDetector, FloatTensor& tensor,
+				int batchIndex, FaceCrop& crop)
+{
+	crop.planeHeight = (float)plane.fullHeight();
 
 	if (useDetector) {
-		//std::cout << "Detecting faces...\n";
+		std::vector<dlib::rectangle> faces;
+		if (!detect(plane, faces))
+			return false;
+
+		const dlib::rectangle& detBBox = faces.front();
+		extractFaceTensor(plane, detBBox.left(), detBBox.right(),
+				detBBox.top(), detBBox.bottom(), true,
+				tensor, batchIndex, crop);
+		return true;
+	}
 
-		matrix<rgb_pixel> imgP(img);
-		pyramid_down<2> pyr;
+	extractFaceTensor(plane, userBBox.left(), userBBox.right(),
+				userBBox.top(), userBBox.bottom(), false,
+				tensor, batchIndex, crop);
+	return true;
+}
 
-		unsigned int levels = _upsample;
-        	while (levels > 0) {
-			levels--;
-			pyramid_up(imgP, pyr);
-		}
-		//auto dets = data.net(imgP);
-		// HOG detector
-		auto dets = _detector(imgP);
 
-		if (dets.size() < 1) {
-			std::cout << "No faces found.\n";
-			return Tensor();
-		}
-		//auto detBBox = pyr.rect_down(dets.at(0).rect, _upsample);
-		// HOG detector
-		auto detBBox = pyr.rect_down(dets.at(0), _upsample);
+FloatTensor Nuke2TensorFlow::imagePlane2Tensor(const ImageView& plane,
+					const dlib::rectangle& userBBox,
+					bool useDetector)
+{
+	FloatTensor tensor(1, _resolution, _resolution, 3);
+	if (!plane2Tensor(plane, userBBox, useDetector, tensor, 0, _crop))
+		return FloatTensor();
+	return tensor;
+}
+
+
+// The plane is converted and detected on once however many faces there
+// are, the faces' warps are the only per-face work before the inference
+FloatTensor Nuke2TensorFlow::facesPlane2Tensor(const ImageView& plane,
+						size_t maxFaces)
+{
+	TRACE_SCOPE("facesPlane2Tensor");
+	std::vector<dlib::rectangle> faces;
+	if (maxFaces == 0 || !detect(plane, faces)) {
+		_batchCrops.clear();
+		return FloatTensor();
+	}
+	if (faces.size() > maxFaces)
+		faces.resize(maxFaces);
+
+	FloatTensor tensor(faces.size(), _resolution, _resolution, 3);
+	_batchCrops.resize(faces.size());
+	for (size_t i = 0; i < faces.size(); i++) {
+		const dlib::rectangle& face = faces[i];
+		_batchCrops[i].planeHeight = (float)plane.fullHeight();
+		extractFaceTensor(plane, face.left(), face.right(),
+				face.top(), face.bottom(), true,
+				tensor, i, _batchCrops[i]);
+	}
+	return tensor;
+}
+
 
-		return extractFaceTensor(img, detBBox.left(), detBBox.right(),
-				detBBox.top(), detBBox.bottom(), true);
+FloatTensor Nuke2TensorFlow::trackedPlane2Tensor(const ImageView& plane,
+					const dlib::rectangle& face)
+{
+	FloatTensor tensor(1, _resolution, _resolution, 3);
+	_crop.planeHeight = (float)plane.fullHeight();
+	// cropped as a detection, the key points cover the same area
+	extractFaceTensor(plane, face.left(), face.right(), face.top(),
+				face.bottom(), true, tensor, 0, _crop);
+	return tensor;
+}
+
+
+dlib::rectangle Nuke2TensorFlow::keyPointsBox(const Point3* points,
+				IndexView kptIndices,
+				float planeHeight)
+{
+	float minX = 1e9f, minY = 1e9f, maxX = -1e9f, maxY = -1e9f;
+	for (int i : kptIndices) {
+		const Point3& p = points[i];
+		float y = planeHeight - 1 - p.y;
+		minX = std::min(minX, p.x);
+		maxX = std::max(maxX, p.x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
 	}
-	auto ipBBox = plane.bounds();
+	return dlib::rectangle(std::lround(minX), std::lround(minY),
+				std::lround(maxX), std::lround(maxY));
+}
 
-	//std::cout << "Using the provided bounding box for inference.\n";
-	return extractFaceTensor(img, userBBox.x(), userBBox.r(),
-				ipBBox.h() - userBBox.t(),
-				ipBBox.h() - userBBox.y(), false);
+
+FloatTensor Nuke2TensorFlow::imagePlanes2Tensor(
+			const std::vector<ImageView>& planes,
+			const dlib::rectangle& userBBox,
+			bool useDetector,
+			std::vector<size_t>& fitted)
+{
+	fitted.clear();
+	_batchCrops.resize(planes.size());
+	if (planes.empty())
+		return FloatTensor();
+
+	FloatTensor tensor(planes.size(), _resolution, _resolution, 3);
+	int batchIndex = 0;
+	for (size_t i = 0; i < planes.size(); i++) {
+		// a frame without a face is overwritten by the next one
+		if (plane2Tensor(planes[i], userBBox, useDetector, tensor,
+				batchIndex, _batchCrops[batchIndex])) {
+			fitted.push_back(i);
+			batchIndex++;
+		}
+	}
+	_batchCrops.resize(batchIndex);
+
+	if (batchIndex == 0)
+		return FloatTensor();
+	if (batchIndex < (int)planes.size())
+		return tensor.slice(0, batchIndex);
+	return tensor;
 }
@@ -17,16 +17,26 @@
 #ifndef NUKE2TF_H_
 #define NUKE2TF_H_
 
-#include <DDImage/ImagePlane.h>
-#include <DDImage/GeoInfo.h>
+#include "faceassets.h"
+#include "floattensor.h"
+#include "imageview.h"
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/dnn.h>
-#include <tensorflow/core/framework/tensor.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 
 
+// The conversions don't depend on the Nuke SDK nor on the inference
+// engine, images come in as ImageView, crops go to the network as
+// FloatTensor and points come out as Point3 in Nuke's coordinates,
+// i.e. y goes up from the bottom of the frame. Bounding boxes are
+// in dlib's top-down coordinates of the whole frame.
+
 typedef std::vector<dlib::vector<int,2>> WarpPointList;
-typedef std::vector<DD::Image::Vector3> UVList;
+typedef Point3List UVList;
 
 
 /* The CNN face detector */
@@ -45,67 +55,246 @@ using net_type = dlib::loss_mmod<dlib::con<1,9,9,1,1,rcon5<rcon5<
 	rcon5<downsampler<dlib::input_rgb_image_pyramid<
 		dlib::pyramid_down<6>>>>>>>>;
 
+// The face detectors, dlib's HOG one is quick, the MMOD CNN one also
+// finds turned and partly covered faces and is a lot slower on CPU
+enum DetectorType {
+	kHogDetector,
+	kCnnDetector,
+	kNumDetectors
+};
+
+const char* detectorName(DetectorType type);
+bool parseDetector(const std::string& name, DetectorType& type);
+
+// The detector and the smallest face it should find in the frame's
+// pixels. The frame is detected on at the scale where such a face fills
+// the detector's window, on a proxy downscaled by a whole factor or
+// upsampled. 0 expects the faces to be larger than a sixth of the frame's
+// height, which is usually the case for plates.
+struct DetectorConfig
+{
+	DetectorType type = kHogDetector;
+	int minFaceSize = 0;
+};
+
+// dlib's MMOD CNN face detector. The model is loaded on the first
+// detection, never if the detector isn't selected, and a single network
+// runs one detection at a time.
+class CnnFaceDetector {
+public:
+	CnnFaceDetector(const std::string& modelPath) : _modelPath(modelPath) {}
+	// false if the model couldn't be loaded
+	bool detect(const dlib::matrix<dlib::rgb_pixel>& img,
+				std::vector<dlib::rectangle>& faces);
+	bool loaded() const;
+private:
+	std::string _modelPath;
+	std::unique_ptr<net_type> _net;
+	bool _failed = false;
+	mutable std::mutex _mutex;
+
+	bool load();
+};
+
+// The points a geometry carries, gathered from the position map's texels,
+// and where the key points are among them, for the tracking and the
+// keyframes. Only the points of the output mode are extracted.
+struct PointLayout
+{
+	// texels of the map in the points' order, empty for all of them
+	IndexView indices;
+	// positions of the key points in the points
+	IndexView kptIndices;
+
+	size_t size(int resolution) const {
+		return indices.empty() ?
+			(size_t)resolution * resolution : indices.size();
+	}
+};
+
+// The primitives of an output mode over the points of its layout, in flat
+// arrays. They're made once with the static data and all the ops share
+// them, rebuilding the geometry is a walk over them.
+struct Topology
+{
+	std::vector<int> triangles;	// 3 corners each
+	std::vector<int> points;	// a disc each
+	std::vector<int> lines;		// the 2 ends of each segment
+
+	size_t bytes() const {
+		return (triangles.size() + points.size() + lines.size()) *
+								sizeof(int);
+	}
+};
+
+// The affine transform from a frame into the network's input,
+// the height of the frame for flipping the coordinates back
+// and the face's bounding box the crop is made of
+struct FaceCrop
+{
+	dlib::point_transform_affine transform;
+	float planeHeight = 0;
+	dlib::rectangle face;
+};
+
 class Nuke2TensorFlow {
+	// times the private stages in isolation
+	friend class StageBenchmark;
 public:
 	Nuke2TensorFlow(int resolution);
-	tensorflow::Tensor imagePlane2Tensor(const DD::Image::ImagePlane& plane,
-						const DD::Image::Box& userBBox,
+	FloatTensor imagePlane2Tensor(const ImageView& plane,
+						const dlib::rectangle& userBBox,
 						bool useDetector);
-	void extractDataFromTensor(tensorflow::Tensor&);
-	const DD::Image::PointList& points() { return _points; }
+	// Packs a face crop of each plane into a single [n,H,W,C] tensor.
+	// Planes without a detected face are skipped, "fitted" receives
+	// indices of the planes which made it into the batch in order.
+	FloatTensor imagePlanes2Tensor(
+			const std::vector<ImageView>& planes,
+			const dlib::rectangle& userBBox,
+			bool useDetector,
+			std::vector<size_t>& fitted);
+	// Detects once and packs a crop of each face found in the plane,
+	// at most maxFaces of them, into a single [n,H,W,C] tensor.
+	// The crops are batchCrops() in the same order.
+	FloatTensor facesPlane2Tensor(const ImageView& plane,
+					size_t maxFaces);
+	// The detector of the following detections, the CNN one falls back
+	// to HOG without the network
+	void setDetector(const DetectorConfig& config,
+				CnnFaceDetector* cnn = nullptr);
+	const DetectorConfig& detector() const { return _detectorConfig; }
+	// The whole factor a frame of the given height is downscaled by for
+	// the detection, or how many times it's upsampled
+	static void detectionScale(const DetectorConfig& config,
+				int frameHeight, int& factor,
+				unsigned& upsample);
+	// All the faces in the plane in the detector's order, false if it's
+	// found none
+	bool detect(const ImageView& plane,
+			std::vector<dlib::rectangle>& faces);
+	// Crops around a face known from elsewhere, e.g. from the key points
+	// of the previous frame, the detector isn't run
+	FloatTensor trackedPlane2Tensor(const ImageView& plane,
+					const dlib::rectangle& face);
+	// Extracts a batch item of the tensor cropped with the crop, e.g.
+	// one of batchCrops() or another instance's, straight into a
+	// destination of the layout's size, e.g. into the geometry's points,
+	// without a copy. Only the layout's texels are gathered, in their
+	// order. It doesn't touch the instance's state.
+	void extractDataFromTensor(const FloatTensor& tensor,
+					const FaceCrop& crop,
+					const PointLayout& layout,
+					Point3* points,
+					int batchIndex = 0) const;
+	// The same into a list resized to the texels given, by default all
+	// of the map
+	void extractDataFromTensor(const FloatTensor& tensor,
+					const FaceCrop& crop,
+					Point3List& points,
+					IndexView indices = IndexView(),
+					int batchIndex = 0) const;
+	// The same of the last imagePlane2Tensor() call into points()
+	void extractDataFromTensor(const FloatTensor&,
+					IndexView indices = IndexView());
+	const Point3List& points() { return _points; }
+	// The crop of the last imagePlane2Tensor() call
+	const FaceCrop& crop() const { return _crop; }
+	// The crops of the last batch, of imagePlanes2Tensor() or
+	// facesPlane2Tensor()
+	const std::vector<FaceCrop>& batchCrops() const {
+		return _batchCrops;
+	}
+	// The box around the key points of extracted points in top-down
+	// coordinates, what the detector would find for the same face
+	static dlib::rectangle keyPointsBox(const Point3* points,
+				IndexView kptIndices,
+				float planeHeight);
 
 	struct StaticData
 	{
 	private:
-		void readIndices(const std::string& path,
-					std::vector<int>& indices);
-		DD::Image::PointList _defaultPoints;
-		std::vector<int> _faceIndices;
-		std::vector<int> _kptIndices;
-		std::vector<int> _triIndices;
-		std::map<int,int> _face2all;
-		UVList _uvs;
+		FaceAssets _assets;
 		std::set<int> _endList;
+		// key points outside of the face's mask, the face's
+		// points are followed by them
+		std::vector<int> _faceLayoutIndices;
+		std::vector<int> _faceKptPositions;
+		std::vector<int> _kptPositions;
+		PointLayout _faceLayout;
+		PointLayout _kptLayout;
+		Topology _meshTopology;
+		Topology _cloudTopology;
+		Topology _kptTopology;
+		void makeLayouts(int resolution);
+		void makeTopologies();
 	public:
-		net_type net;
+		CnnFaceDetector cnnDetector;
+		// The indices, default points and UVs are mapped from the
+		// asset if it's there and up to date, otherwise they're
+		// parsed from the text files. Progress, if given, goes
+		// from 0 to 1 as it loads.
 		StaticData(const std::string& DetectorModelPath,
 			const std::string& trianglesPath,
 			const std::string& faceIndicesPath,
 			const std::string& kptIndicesPath,
-			int resolution);
-		const DD::Image::PointList& defaultPoints() {
-			return _defaultPoints;
+			int resolution,
+			const std::string& assetPath = "",
+			std::atomic<float>* progress = nullptr);
+		ArrayView<Point3> defaultPoints() const {
+			return _assets.defaultPoints();
+		}
+		IndexView faceIndices() const { return _assets.faceIndices(); }
+		// a face point's index in the whole position map
+		IndexView face2all() const { return _assets.faceIndices(); }
+		IndexView kptIndices() const { return _assets.kptIndices(); }
+		IndexView triIndices() const { return _assets.triIndices(); }
+		ArrayView<Point3> uvs() const { return _assets.uvs(); }
+		const std::set<int>& endList() const { return _endList; }
+		// The mesh's and the point cloud's points, the face's
+		// vertices in the order of faceIndices(), so the triangles
+		// index them as they are
+		const PointLayout& faceLayout() const { return _faceLayout; }
+		// the 68 key points alone
+		const PointLayout& kptLayout() const { return _kptLayout; }
+		// all the texels of the map
+		PointLayout mapLayout() const {
+			return { IndexView(), _assets.kptIndices() };
+		}
+		// the triangles over faceLayout()'s points
+		const Topology& meshTopology() const { return _meshTopology; }
+		// the face's points without the triangles
+		const Topology& cloudTopology() const {
+			return _cloudTopology;
 		}
-		const std::vector<int>& faceIndices() { return _faceIndices; }
-		const std::map<int,int>& face2all() { return _face2all; }
-		const std::vector<int>& kptIndices() { return _kptIndices; }
-		const std::vector<int>& triIndices() { return _triIndices; }
-		const UVList& uvs() { return _uvs; }
-		const std::set<int>& endList() { return _endList; }
+		// the key points and the lines of the eyebrows, the eyes etc.
+		// over kptLayout()'s points
+		const Topology& kptTopology() const { return _kptTopology; }
+		const FaceAssets& assets() const { return _assets; }
 	};
-	static StaticData data;
 
 private:
-	DD::Image::PointList _points;
-	// An HOG face detector.
-	// it's faster and less accurate, it can be enabled in the code
+	Point3List _points;
 	dlib::frontal_face_detector _detector;
-	dlib::point_transform_affine _pointTransform;
-	float _planeHeight;
-	float _planeWidth;
+	DetectorConfig _detectorConfig;
+	CnnFaceDetector* _cnn = nullptr;
+	FaceCrop _crop;
+	std::vector<FaceCrop> _batchCrops;
 	int _resolution;
 	WarpPointList _destPoints;
-	// number of upsamples for more precise detection
-	unsigned int _upsample = 1;
-	
-	void plane2img(const DD::Image::ImagePlane& plane,
+
+	void plane2img(const ImageView& plane, const dlib::rectangle& region,
+			dlib::matrix<dlib::rgb_pixel>& img);
+	void plane2proxy(const ImageView& plane, int factor,
 			dlib::matrix<dlib::rgb_pixel>& img);
-	unsigned char linear2srgb(float c);
-	tensorflow::Tensor extractFaceTensor(
-		const dlib::matrix<dlib::rgb_pixel>& inImg,
-		int l, int r, int t, int b, bool detected);
-	tensorflow::Tensor img2Tensor(
-		const dlib::matrix<dlib::rgb_pixel>& img);
+	bool plane2Tensor(const ImageView& plane,
+			const dlib::rectangle& userBBox, bool useDetector,
+			FloatTensor& tensor, int batchIndex,
+			FaceCrop& crop);
+	void extractFaceTensor(
+		const ImageView& plane,
+		int l, int r, int t, int b, bool detected,
+		FloatTensor& tensor, int batchIndex,
+		FaceCrop& crop);
 };
 
 
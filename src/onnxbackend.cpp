@@ -0,0 +1,119 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "onnxbackend.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+
+// A process can have a single environment
+static Ort::Env& env()
+{
+	static Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "facefit");
+	return env;
+}
+
+
+std::string onnxModelPath(const std::string& checkpointPath,
+						ModelVariant variant)
+{
+	return checkpointPath + (variant == kInt8 ? "_int8.onnx" : ".onnx");
+}
+
+
+std::unique_ptr<InferenceBackend> OnnxBackend::load(
+						const ModelConfig& config)
+{
+	std::unique_ptr<OnnxBackend> backend(new OnnxBackend);
+
+	// only the int8 model is there besides the float one
+	std::vector<ModelVariant> variants;
+	if (config.variant == kInt8)
+		variants.push_back(kInt8);
+	variants.push_back(kFrozen);
+
+	Ort::SessionOptions options;
+	options.SetGraphOptimizationLevel(
+			GraphOptimizationLevel::ORT_ENABLE_ALL);
+	if (config.threads > 0) {
+		// every session has pools of its own, the budget is split
+		options.SetIntraOpNumThreads(std::max(1,
+				config.threads / std::max(1, config.sharedSessions)));
+		options.SetInterOpNumThreads(1);
+	}
+
+	for (ModelVariant v : variants) {
+		std::string path = onnxModelPath(config.checkpointPath, v);
+		if (!std::ifstream(path).good()) {
+			std::cout << "No " << path << ", run export_onnx.py"
+				<< (v == kInt8 ? " int8" : "") << "\n";
+			continue;
+		}
+		try {
+			backend->_session.reset(new Ort::Session(env(),
+						path.c_str(), options));
+		} catch (const Ort::Exception& e) {
+			std::cout << "Failed to load " << path << ": "
+						<< e.what() << "\n";
+			continue;
+		}
+		backend->_variant = v;
+		// tf2onnx keeps TF's names of the tensors
+		backend->_inputName = std::string(kInputName) + ":0";
+		backend->_outputName = std::string(kOutputName) + ":0";
+		std::cout << "Loaded " << path << "\n";
+		return std::move(backend);
+	}
+	return nullptr;
+}
+
+
+FloatTensor OnnxBackend::infer(const FloatTensor& input)
+{
+	TRACE_SCOPE("session run");
+	static const Ort::MemoryInfo memory = Ort::MemoryInfo::CreateCpu(
+				OrtArenaAllocator, OrtMemTypeDefault);
+
+	// the input is wrapped, not copied
+	int64_t shape[4] = { input.dimSize(0), input.dimSize(1),
+				input.dimSize(2), input.dimSize(3) };
+	Ort::Value img = Ort::Value::CreateTensor<float>(memory,
+				input.data(), input.size(), shape, 4);
+	const char* inputNames[] = { _inputName.c_str() };
+	const char* outputNames[] = { _outputName.c_str() };
+
+	std::vector<Ort::Value> outputs;
+	try {
+		outputs = _session->Run(Ort::RunOptions{nullptr},
+				inputNames, &img, 1, outputNames, 1);
+	} catch (const Ort::Exception& e) {
+		std::cout << "Forward propagation failed: " << e.what() << "\n";
+		return FloatTensor();
+	}
+
+	std::vector<int64_t> dims =
+		outputs.at(0).GetTensorTypeAndShapeInfo().GetShape();
+	if (dims.size() != 4)
+		return FloatTensor();
+	// the result keeps the output value alive instead of copying it
+	auto output = std::make_shared<Ort::Value>(std::move(outputs[0]));
+	return FloatTensor(output, output->GetTensorMutableData<float>(),
+				dims[0], dims[1], dims[2], dims[3]);
+}
@@ -0,0 +1,51 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef ONNXBACKEND_H_
+#define ONNXBACKEND_H_
+
+#include "backend.h"
+#include <onnxruntime_cxx_api.h>
+
+
+// The network exported by export_onnx.py run by ONNX Runtime on CPU,
+// a few megabytes of a library instead of TensorFlow's hundreds
+class OnnxBackend : public InferenceBackend {
+public:
+	static std::unique_ptr<InferenceBackend> load(
+					const ModelConfig& config);
+
+	FloatTensor infer(const FloatTensor& input) override;
+	ModelVariant variant() const override { return _variant; }
+	BackendType type() const override { return kOnnxBackend; }
+
+private:
+	OnnxBackend() {}
+	OnnxBackend(const OnnxBackend&) = delete;
+	OnnxBackend& operator=(const OnnxBackend&) = delete;
+
+	std::unique_ptr<Ort::Session> _session;
+	std::string _inputName;
+	std::string _outputName;
+	ModelVariant _variant = kFrozen;
+};
+
+// <checkpoint>.onnx or <checkpoint>_int8.onnx
+std::string onnxModelPath(const std::string& checkpointPath,
+						ModelVariant variant);
+
+
+#endif // ONNXBACKEND_H_
@@ -15,77 +15,102 @@
  * ************************************************************************/
 
 #include "prnet.h"
+#include "trace.h"
 
-#include <tensorflow/core/protobuf/meta_graph.pb.h>
-#include <tensorflow/core/public/session_options.h>
+#include <cstring>
 
-using namespace tensorflow;
 
-typedef std::vector<std::pair<std::string, Tensor>> tensor_dict;
+PRNet::PRNet(const ModelConfig& config, int batchSize) :
+	_config(config)
+{
+	setBatchSize(batchSize);
+	TRACE_SCOPE("load model");
+	_backend = createBackend(config);
+}
 
 
-PRNet::PRNet(const std::string& metaGraphPath,
-		const std::string& checkpointPath)
+FloatTensor PRNet::infer(const FloatTensor& img)
 {
-	std::cout << "Loading the neural network...\n";
-	Status status;
-	SessionOptions options;
-	TF_CHECK_OK(NewSession(options, &_sess));
-	TF_CHECK_OK(loadModel(metaGraphPath, checkpointPath));
+	if (!_backend) {
+		trace::count(trace::kFailedInferences, img.dimSize(0));
+		return FloatTensor();
+	}
+	FloatTensor output = _backend->infer(img);
+	if (output.dims() == 4)
+		trace::count(trace::kInferences, img.dimSize(0));
+	else
+		trace::count(trace::kFailedInferences, img.dimSize(0));
+	return output;
 }
 
 
-Tensor PRNet::infer(const tensorflow::Tensor& img)
+ModelVariant PRNet::variant() const
 {
-	// std::cout << "Starting forward propagation...\n";
-	tensor_dict feed_dict = {{"Placeholder", img}};
-	std::vector<Tensor> outputs;
-	Status status = _sess->Run(
-		feed_dict,
-		{"resfcn256/Conv2d_transpose_16/Sigmoid"},
-		{},
-		&outputs
-	);
-	Tensor output = outputs.at(0);
-	return output;
+	return _backend ? _backend->variant() : _config.variant;
 }
 
-// https://github.com/PatWie/tensorflow-cmake/
-Status PRNet::loadModel(const std::string& metaGraphPath,
-			const std::string& checkpointPath)
+
+BackendType PRNet::backend() const
 {
-	Status status;
-
-	// Read in the protobuf graph we exported
-	MetaGraphDef graph_def;
-	status = ReadBinaryProto(Env::Default(), metaGraphPath, &graph_def);
-	if (status != Status::OK())
-		return status;
-
-	// create the graph in the current session
-	status = _sess->Create(graph_def.graph_def());
-	if (status != Status::OK())
-		return status;
-
-	// restore model from checkpoint, iff checkpoint is given
-	if (checkpointPath != "") {
-		const std::string restore_op_name = graph_def.saver_def().restore_op_name();
-		const std::string filename_tensor_name =
-			graph_def.saver_def().filename_tensor_name();
-
-		Tensor filename_tensor(DT_STRING, TensorShape());
-		filename_tensor.scalar<std::string>()() = checkpointPath;
-
-		tensor_dict feed_dict = {{filename_tensor_name, filename_tensor}};
-
-		status = _sess->Run(feed_dict, {}, {restore_op_name}, nullptr);
-		if (status != Status::OK())
-			return status;
-	} else {
-		status = _sess->Run({}, {}, {"init"}, nullptr);
-		if (status != Status::OK())
-			return status;
-	}
+	return _config.backend;
+}
 
-	return Status::OK();
+
+void PRNet::setBatchSize(int batchSize)
+{
+	_batchSize = batchSize > 0 ? batchSize : 1;
+}
+
+
+std::vector<FloatTensor> PRNet::inferBatch(
+				const std::vector<FloatTensor>& imgs)
+{
+	std::vector<FloatTensor> results(imgs.size());
+
+	size_t first = 0;
+	while (first < imgs.size()) {
+		// collect as many inputs as fit into a batch, an input
+		// which is larger than the batch on its own is run alone
+		size_t last = first;
+		int64_t rows = 0;
+		while (last < imgs.size()) {
+			int64_t n = imgs[last].dimSize(0);
+			if (last > first && rows + n > _batchSize)
+				break;
+			rows += n;
+			last++;
+		}
+
+		FloatTensor batch;
+		if (last - first == 1) {
+			batch = imgs[first];
+		} else {
+			const FloatTensor& img = imgs[first];
+			batch = FloatTensor(rows, img.dimSize(1),
+					img.dimSize(2), img.dimSize(3));
+			float* dst = batch.data();
+			for (size_t i = first; i < last; i++) {
+				std::memcpy(dst, imgs[i].data(),
+					imgs[i].size() * sizeof(float));
+				dst += imgs[i].size();
+			}
+		}
+
+		FloatTensor output = infer(batch);
+		if (output.dims() != 4) {
+			// leave empty tensors for the failed chunk
+			first = last;
+			continue;
+		}
+
+		// slices share the buffer of the batched output
+		int64_t start = 0;
+		for (size_t i = first; i < last; i++) {
+			int64_t n = imgs[i].dimSize(0);
+			results[i] = output.slice(start, start + n);
+			start += n;
+		}
+		first = last;
+	}
+	return results;
 }
@@ -17,19 +17,39 @@
 #ifndef PRNET_H_
 #define PRNET_H_
 
-#include <tensorflow/core/public/session.h>
+#include "backend.h"
+#include <memory>
 #include <string>
+#include <vector>
 
 
+// The graph's placeholder has a None batch dimension, so several
+// face crops can be evaluated with a single run of the backend
+static const int kDefaultBatchSize = 8;
+
+
+// The position map regression on the backend the config names
 class PRNet {
 public:
-	PRNet(const std::string& metaGraphPath,
-		const std::string& checkpointPath);
-	tensorflow::Tensor infer(const tensorflow::Tensor& img);
+	PRNet(const ModelConfig& config, int batchSize = kDefaultBatchSize);
+	FloatTensor infer(const FloatTensor& img);
+	// Packs [1,H,W,C] or [n,H,W,C] tensors into chunks of batchSize(),
+	// runs each chunk at once and scatters the result back, one
+	// output tensor per input tensor with the same batch dimension
+	std::vector<FloatTensor> inferBatch(
+			const std::vector<FloatTensor>& imgs);
+	int batchSize() const { return _batchSize; }
+	void setBatchSize(int batchSize);
+	// false if the model has failed to load, the results are empty then
+	bool loaded() const { return _backend != nullptr; }
+	// the loaded one, if the requested variant is missing, it falls back
+	// to the frozen graph and then to the meta graph
+	ModelVariant variant() const;
+	BackendType backend() const;
 private:
-	tensorflow::Session *_sess;
-	tensorflow::Status loadModel(const std::string& metaGraphPath,
-				const std::string& checkpointPath);
+	std::unique_ptr<InferenceBackend> _backend;
+	ModelConfig _config;
+	int _batchSize;
 };
 
 #endif // PRNET_H_
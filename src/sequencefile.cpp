@@ -0,0 +1,682 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "sequencefile.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kMagic[4] = { 'F', 'F', 'S', 'Q' };
+static const char kFrameMagic[4] = { 'F', 'F', 'F', 'R' };
+static const char kIndexMagic[4] = { 'F', 'F', 'I', 'X' };
+static const uint32_t kVersion = 1;
+
+static const char* kEncodingNames[kNumPointEncodings] = {
+	"float", "half", "int16"
+};
+
+struct SequenceHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t encoding;
+	uint32_t resolution;
+	uint32_t numPoints;
+	uint32_t numIndices;
+	uint32_t numKptIndices;
+	uint32_t numTriIndices;
+	uint32_t numLineIndices;
+	uint32_t reserved[3];
+};
+
+struct FrameRecord
+{
+	char magic[4];
+	int32_t frame;
+	uint32_t numFaces;
+	uint32_t reserved;
+};
+
+struct FaceRecord
+{
+	int32_t id;
+	float origin[3];
+	float scale[3];
+};
+
+struct IndexEntry
+{
+	int32_t frame;
+	uint32_t reserved;
+	uint64_t offset;
+};
+
+struct IndexFooter
+{
+	uint64_t offset;
+	uint32_t numFrames;
+	char magic[4];
+};
+
+static_assert(sizeof(SequenceHeader) == 48, "unexpected header size");
+static_assert(sizeof(FrameRecord) == 16, "unexpected frame record size");
+static_assert(sizeof(FaceRecord) == 28, "unexpected face record size");
+static_assert(sizeof(IndexEntry) == 16, "unexpected index entry size");
+static_assert(sizeof(IndexFooter) == 16, "unexpected footer size");
+
+
+// Everything starts at 8 bytes, so the index follows the last frame
+// without a gap and a continued file is scanned through
+static uint64_t align8(uint64_t n)
+{
+	return (n + 7) & ~(uint64_t)7;
+}
+
+
+static size_t valueBytes(PointEncoding encoding)
+{
+	return encoding == kFloatPoints ? sizeof(float) : sizeof(uint16_t);
+}
+
+
+static uint64_t faceBytes(size_t numPoints, PointEncoding encoding)
+{
+	return align8(sizeof(FaceRecord) +
+			(uint64_t)numPoints * 3 * valueBytes(encoding));
+}
+
+
+static uint64_t recordsStart(const SequenceHeader& header)
+{
+	return align8(sizeof(SequenceHeader) + sizeof(int32_t) *
+		((uint64_t)header.numIndices + header.numKptIndices +
+		header.numTriIndices + header.numLineIndices));
+}
+
+
+// IEEE half floats rounded to the nearest even, C++11 has no type of them
+static uint16_t floatToHalf(float f)
+{
+	uint32_t x;
+	std::memcpy(&x, &f, sizeof(x));
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t exponent = (x >> 23) & 0xff;
+	uint32_t mantissa = x & 0x7fffff;
+	if (exponent == 0xff)
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+	int e = (int)exponent - 127 + 15;
+	if (e >= 31)
+		return sign | 0x7c00;
+	if (e <= 0) {
+		// subnormal or zero
+		if (e < -10)
+			return sign;
+		mantissa |= 0x800000;
+		int shift = 14 - e;
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t middle = 1u << (shift - 1);
+		if (rest > middle || (rest == middle && (half & 1)))
+			half++;
+		return sign | half;
+	}
+	// a carry out of the mantissa goes into the exponent as it should
+	uint32_t half = ((uint32_t)e << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++;
+	return sign | half;
+}
+
+
+static float halfToFloat(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	int exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+	uint32_t x;
+	if (exponent == 0x1f) {
+		x = sign | 0x7f800000 | (mantissa << 13);
+	} else if (exponent == 0) {
+		if (mantissa == 0) {
+			x = sign;
+		} else {
+			// subnormal, normalised for the float
+			exponent = 1;
+			while (!(mantissa & 0x400)) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			mantissa &= 0x3ff;
+			x = sign | ((uint32_t)(exponent + 127 - 15) << 23) |
+							(mantissa << 13);
+		}
+	} else {
+		x = sign | ((uint32_t)(exponent + 127 - 15) << 23) |
+							(mantissa << 13);
+	}
+	float f;
+	std::memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+
+// All of the halves decoded once, a lookup is several times faster than
+// the bits' shuffling for each of a face's coordinates
+static const float* halfTable()
+{
+	static const std::vector<float> table = [] {
+		std::vector<float> t(1 << 16);
+		for (size_t h = 0; h < t.size(); h++)
+			t[h] = halfToFloat(h);
+		return t;
+	}();
+	return table.data();
+}
+
+
+static void encodeFace(int id, const Point3* points, size_t numPoints,
+				PointEncoding encoding, char* dst)
+{
+	float lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < numPoints; i++) {
+		const float v[3] = { points[i].x, points[i].y, points[i].z };
+		for (int c = 0; c < 3; c++) {
+			lo[c] = i == 0 ? v[c] : std::min(lo[c], v[c]);
+			hi[c] = i == 0 ? v[c] : std::max(hi[c], v[c]);
+		}
+	}
+
+	FaceRecord face;
+	face.id = id;
+	for (int c = 0; c < 3; c++) {
+		face.origin[c] = encoding == kFloatPoints ? 0 : lo[c];
+		face.scale[c] = 1;
+		if (encoding == kInt16Points && hi[c] > lo[c])
+			face.scale[c] = (hi[c] - lo[c]) / 65535;
+	}
+	std::memcpy(dst, &face, sizeof(face));
+	dst += sizeof(face);
+
+	if (encoding == kFloatPoints) {
+		std::memcpy(dst, points, numPoints * sizeof(Point3));
+		return;
+	}
+	uint16_t* values = (uint16_t*)dst;
+	for (size_t i = 0; i < numPoints; i++) {
+		const float v[3] = { points[i].x, points[i].y, points[i].z };
+		for (int c = 0; c < 3; c++) {
+			float d = v[c] - face.origin[c];
+			if (encoding == kHalfPoints) {
+				*values++ = floatToHalf(d);
+			} else {
+				long q = std::lround(d / face.scale[c]);
+				*values++ = (uint16_t)std::max(0L,
+						std::min(65535L, q));
+			}
+		}
+	}
+}
+
+
+// The points at the positions or all of them without positions
+static void decodeFace(const char* src, size_t numPoints,
+			PointEncoding encoding, const int* positions,
+			size_t count, Point3* dst)
+{
+	FaceRecord face;
+	std::memcpy(&face, src, sizeof(face));
+	src += sizeof(face);
+	const float* o = face.origin;
+	const float* s = face.scale;
+
+	if (encoding == kFloatPoints) {
+		const Point3* points = (const Point3*)src;
+		if (!positions) {
+			std::memcpy(dst, points, numPoints * sizeof(Point3));
+			return;
+		}
+		for (size_t i = 0; i < count; i++)
+			dst[i] = points[positions[i]];
+		return;
+	}
+
+	const uint16_t* values = (const uint16_t*)src;
+	const float* halves = halfTable();
+	size_t n = positions ? count : numPoints;
+	for (size_t i = 0; i < n; i++) {
+		const uint16_t* v = values + (positions ? positions[i] : i) * 3;
+		if (encoding == kHalfPoints)
+			dst[i].set(o[0] + halves[v[0]], o[1] + halves[v[1]],
+							o[2] + halves[v[2]]);
+		else
+			dst[i].set(o[0] + s[0] * v[0], o[1] + s[1] * v[1],
+						o[2] + s[2] * v[2]);
+	}
+}
+
+
+const char* pointEncodingName(PointEncoding encoding)
+{
+	return kEncodingNames[encoding];
+}
+
+
+bool parsePointEncoding(const std::string& name, PointEncoding& encoding)
+{
+	for (int i = 0; i < kNumPointEncodings; i++) {
+		if (name == kEncodingNames[i]) {
+			encoding = (PointEncoding)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+SequenceWriter::~SequenceWriter()
+{
+	close();
+}
+
+
+static bool sameIndices(IndexView a, const std::vector<int>& b)
+{
+	return a.size() == b.size() && std::equal(b.begin(), b.end(),
+								a.begin());
+}
+
+
+bool SequenceWriter::open(const std::string& path,
+			const SequenceLayout& layout, PointEncoding encoding)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	closeLocked();
+	_numPoints = layout.numPoints();
+	_encoding = encoding;
+	_index.clear();
+
+	// the frames after the last complete one are cut off, so is the
+	// index, it's written again on closing
+	bool continued = false;
+	{
+		SequenceReader existing;
+		if (existing.open(path) && existing.encoding() == encoding &&
+				existing.resolution() == layout.resolution &&
+				existing.numPoints() == _numPoints &&
+				sameIndices(existing.indices(),
+						layout.indices) &&
+				sameIndices(existing.kptIndices(),
+						layout.kptIndices)) {
+			_index = existing._index;
+			_end = existing._end;
+			continued = true;
+		}
+	}
+
+	if (continued) {
+		_file = std::fopen(path.c_str(), "r+b");
+		if (_file && (ftruncate(fileno(_file), _end) != 0 ||
+				fseeko(_file, _end, SEEK_SET) != 0)) {
+			std::fclose(_file);
+			_file = nullptr;
+		}
+		return _file != nullptr;
+	}
+
+	// anything else there, e.g. a take of other points, is left alone,
+	// a reader may have it mapped too
+	int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return false;
+	_file = fdopen(fd, "wb");
+	if (!_file) {
+		::close(fd);
+		return false;
+	}
+
+	SequenceHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, kMagic, 4);
+	header.version = kVersion;
+	header.encoding = encoding;
+	header.resolution = layout.resolution;
+	header.numPoints = _numPoints;
+	header.numIndices = layout.indices.size();
+	header.numKptIndices = layout.kptIndices.size();
+	header.numTriIndices = layout.triangles.size();
+	header.numLineIndices = layout.lines.size();
+	_end = recordsStart(header);
+
+	std::vector<char> start(_end, 0);
+	char* dst = start.data();
+	std::memcpy(dst, &header, sizeof(header));
+	dst += sizeof(header);
+	for (auto* indices : { &layout.indices, &layout.kptIndices,
+				&layout.triangles, &layout.lines }) {
+		for (int index : *indices) {
+			int32_t value = index;
+			std::memcpy(dst, &value, sizeof(value));
+			dst += sizeof(value);
+		}
+	}
+	if (std::fwrite(start.data(), 1, start.size(), _file) !=
+						start.size() ||
+			std::fflush(_file) != 0) {
+		std::fclose(_file);
+		_file = nullptr;
+		return false;
+	}
+	return true;
+}
+
+
+bool SequenceWriter::write(int frame, const std::vector<int>& ids,
+			const std::vector<const Point3*>& faces)
+{
+	TRACE_SCOPE("write sequence frame");
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_file || ids.size() != faces.size())
+		return false;
+
+	uint64_t bytes = faceBytes(_numPoints, _encoding);
+	_buffer.assign(sizeof(FrameRecord) + faces.size() * bytes, 0);
+	FrameRecord record;
+	std::memcpy(record.magic, kFrameMagic, 4);
+	record.frame = frame;
+	record.numFaces = faces.size();
+	record.reserved = 0;
+	std::memcpy(_buffer.data(), &record, sizeof(record));
+	for (size_t i = 0; i < faces.size(); i++) {
+		encodeFace(ids[i], faces[i], _numPoints, _encoding,
+			_buffer.data() + sizeof(FrameRecord) + i * bytes);
+	}
+
+	return appendLocked(frame, _buffer.data(), _buffer.size());
+}
+
+
+bool SequenceWriter::copy(const SequenceReader& reader, int frame)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = reader._index.find(frame);
+	if (!_file || it == reader._index.end() ||
+			reader._encoding != _encoding ||
+			reader._numPoints != _numPoints)
+		return false;
+	const char* record = (const char*)reader._map + it->second;
+	return appendLocked(frame, record, sizeof(FrameRecord) +
+			reader.numFaces(frame) *
+				faceBytes(_numPoints, _encoding));
+}
+
+
+bool SequenceWriter::appendLocked(int frame, const char* data, size_t size)
+{
+	// flushed, a reader mapping the file now sees the whole frame
+	if (std::fwrite(data, 1, size, _file) != size ||
+			std::fflush(_file) != 0)
+		return false;
+	_index[frame] = _end;
+	_end += size;
+	return true;
+}
+
+
+bool SequenceWriter::contains(int frame) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _index.count(frame) > 0;
+}
+
+
+bool SequenceWriter::isOpen() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _file != nullptr;
+}
+
+
+bool SequenceWriter::close()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return closeLocked();
+}
+
+
+bool SequenceWriter::closeLocked()
+{
+	if (!_file)
+		return true;
+	std::vector<IndexEntry> entries;
+	for (auto& frame : _index)
+		entries.push_back({ frame.first, 0, frame.second });
+	IndexFooter footer;
+	footer.offset = _end;
+	footer.numFrames = entries.size();
+	std::memcpy(footer.magic, kIndexMagic, 4);
+
+	bool ok = std::fwrite(entries.data(), sizeof(IndexEntry),
+				entries.size(), _file) == entries.size() &&
+		std::fwrite(&footer, sizeof(footer), 1, _file) == 1;
+	ok = std::fclose(_file) == 0 && ok;
+	_file = nullptr;
+	return ok;
+}
+
+
+SequenceReader::~SequenceReader()
+{
+	close();
+}
+
+
+void SequenceReader::close()
+{
+	if (_map)
+		munmap(_map, _mapSize);
+	_map = nullptr;
+	_mapSize = 0;
+	_index.clear();
+	_complete = false;
+	_end = 0;
+}
+
+
+bool SequenceReader::open(const std::string& path)
+{
+	TRACE_SCOPE("open sequence");
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 ||
+			(size_t)st.st_size < sizeof(SequenceHeader)) {
+		::close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping stays valid after closing the descriptor
+	::close(fd);
+	if (addr == MAP_FAILED)
+		return false;
+
+	const char* base = (const char*)addr;
+	auto header = (const SequenceHeader*)addr;
+	uint64_t start = recordsStart(*header);
+	uint64_t numPoints = header->numIndices ? header->numIndices :
+			(uint64_t)header->resolution * header->resolution;
+	if (std::memcmp(header->magic, kMagic, 4) != 0 ||
+			header->version != kVersion ||
+			header->encoding >= kNumPointEncodings ||
+			header->numPoints != numPoints || start > size) {
+		munmap(addr, size);
+		return false;
+	}
+
+	_map = addr;
+	_mapSize = size;
+	_encoding = (PointEncoding)header->encoding;
+	_resolution = header->resolution;
+	_numPoints = header->numPoints;
+	const int32_t* indices = (const int32_t*)(header + 1);
+	_indices = IndexView(indices, header->numIndices);
+	indices += header->numIndices;
+	_kptIndices = IndexView(indices, header->numKptIndices);
+	indices += header->numKptIndices;
+	_triangles = IndexView(indices, header->numTriIndices);
+	indices += header->numTriIndices;
+	_lines = IndexView(indices, header->numLineIndices);
+
+	uint64_t bytes = faceBytes(_numPoints, _encoding);
+	auto frameSize = [&](uint64_t offset) {
+		auto record = (const FrameRecord*)(base + offset);
+		return sizeof(FrameRecord) + record->numFaces * bytes;
+	};
+
+	// the index of a closed file
+	if (size >= start + sizeof(IndexFooter)) {
+		auto footer = (const IndexFooter*)(base + size -
+							sizeof(IndexFooter));
+		uint64_t end = footer->offset;
+		if (std::memcmp(footer->magic, kIndexMagic, 4) == 0 &&
+				end >= start && end % 8 == 0 &&
+				end + (uint64_t)footer->numFrames *
+					sizeof(IndexEntry) +
+					sizeof(IndexFooter) == size) {
+			auto entries = (const IndexEntry*)(base + end);
+			_complete = true;
+			for (uint32_t i = 0; i < footer->numFrames; i++) {
+				uint64_t offset = entries[i].offset;
+				if (offset < start || offset +
+						sizeof(FrameRecord) > end ||
+						frameSize(offset) >
+							end - offset) {
+					_complete = false;
+					break;
+				}
+				_index[entries[i].frame] = offset;
+			}
+			if (_complete)
+				_end = end;
+			else
+				_index.clear();
+		}
+	}
+
+	// an unfinished file up to its last complete frame
+	if (!_complete) {
+		uint64_t offset = start;
+		while (offset + sizeof(FrameRecord) <= size) {
+			auto record = (const FrameRecord*)(base + offset);
+			if (std::memcmp(record->magic, kFrameMagic, 4) != 0 ||
+					frameSize(offset) > size - offset)
+				break;
+			_index[record->frame] = offset;
+			offset += frameSize(offset);
+		}
+		_end = offset;
+	}
+	return true;
+}
+
+
+SequenceLayout SequenceReader::layout() const
+{
+	SequenceLayout layout;
+	layout.resolution = _resolution;
+	layout.indices.assign(_indices.begin(), _indices.end());
+	layout.kptIndices.assign(_kptIndices.begin(), _kptIndices.end());
+	layout.triangles.assign(_triangles.begin(), _triangles.end());
+	layout.lines.assign(_lines.begin(), _lines.end());
+	return layout;
+}
+
+
+std::vector<int> SequenceReader::frames() const
+{
+	std::vector<int> frames;
+	for (auto& frame : _index)
+		frames.push_back(frame.first);
+	return frames;
+}
+
+
+int SequenceReader::numFaces(int frame) const
+{
+	auto it = _index.find(frame);
+	if (it == _index.end())
+		return -1;
+	return ((const FrameRecord*)((const char*)_map +
+						it->second))->numFaces;
+}
+
+
+const char* SequenceReader::face(int frame, int face) const
+{
+	if (face < 0 || face >= numFaces(frame))
+		return nullptr;
+	return (const char*)_map + _index.at(frame) + sizeof(FrameRecord) +
+			face * faceBytes(_numPoints, _encoding);
+}
+
+
+int SequenceReader::faceId(int frame, int face) const
+{
+	const char* data = this->face(frame, face);
+	if (!data)
+		return -1;
+	FaceRecord record;
+	std::memcpy(&record, data, sizeof(record));
+	return record.id;
+}
+
+
+bool SequenceReader::read(int frame, int face, Point3* points) const
+{
+	const char* data = this->face(frame, face);
+	if (!data)
+		return false;
+	decodeFace(data, _numPoints, _encoding, nullptr, 0, points);
+	return true;
+}
+
+
+bool SequenceReader::read(int frame, int face, IndexView positions,
+					Point3* points) const
+{
+	const char* data = this->face(frame, face);
+	if (!data)
+		return false;
+	for (int position : positions) {
+		if (position < 0 || (size_t)position >= _numPoints)
+			return false;
+	}
+	decodeFace(data, _numPoints, _encoding, positions.data(),
+					positions.size(), points);
+	return true;
+}
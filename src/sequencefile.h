@@ -0,0 +1,185 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef SEQUENCEFILE_H_
+#define SEQUENCEFILE_H_
+
+#include "imageview.h"
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// Fitted takes on disk, the points of each frame's faces one frame after
+// another and what they share, the layout and the topology, once at the
+// start. The writer appends a frame at a time and flushes it, so a take
+// being rendered can be read already, and it ends the file with an index
+// of the frames once it's closed. A reader maps the file, playing an
+// already fitted take back costs a page-in of the frame.
+//
+// The file layout is a 48 bytes header
+//   char[4] magic "FFSQ", uint32 version, uint32 encoding,
+//   uint32 resolution, uint32 numPoints, uint32 numIndices,
+//   uint32 numKptIndices, uint32 numTriIndices, uint32 numLineIndices,
+//   uint32[3] reserved
+// followed by the int32 texels of the points, the positions of the key
+// points among them, the triangles' and the lines' corners, padded to 8
+// bytes, then frames
+//   char[4] magic "FFFR", int32 frame, uint32 numFaces, uint32 reserved
+// each followed by its faces
+//   int32 id, float[3] origin, float[3] scale
+// and the face's numPoints xyz, a point's coordinate is origin + scale *
+// the stored value, padded to 8 bytes. A closed file ends with the
+// entries of the frames in order
+//   int32 frame, uint32 reserved, uint64 offset of the frame
+// and a 16 bytes footer
+//   uint64 offset of the entries, uint32 numFrames, char[4] magic "FFIX"
+// A file without the footer is scanned up to its last complete frame.
+
+// How the coordinates are stored, relative to the face's box apart from
+// the floats. Half floats are within half a step of their 11 bits, 1/2048
+// of the box's size, about a quarter of a pixel for a face 500 pixels
+// large. Int16 steps are 1/65535 of the box, so the points are within
+// 1/131070 of it.
+enum PointEncoding {
+	kFloatPoints,
+	kHalfPoints,
+	kInt16Points,
+	kNumPointEncodings
+};
+
+const char* pointEncodingName(PointEncoding encoding);
+bool parsePointEncoding(const std::string& name, PointEncoding& encoding);
+
+// What the frames of a take share, the points are gathered from the
+// position map's texels like the plug-in's output modes'
+struct SequenceLayout
+{
+	int resolution = 0;
+	// texels of the map in the points' order, empty for all of them
+	std::vector<int> indices;
+	// positions of the key points in the points
+	std::vector<int> kptIndices;
+	// the topology over the points, 3 corners a triangle, 2 ends a line
+	std::vector<int> triangles;
+	std::vector<int> lines;
+
+	size_t numPoints() const {
+		return indices.empty() ?
+			(size_t)resolution * resolution : indices.size();
+	}
+};
+
+
+class SequenceReader;
+
+// Several threads may write at once, e.g. a node's instances rendering.
+class SequenceWriter {
+public:
+	~SequenceWriter();
+	// An existing file of the same layout and encoding is continued,
+	// its frames are kept, any other existing file isn't touched and
+	// it fails
+	bool open(const std::string& path, const SequenceLayout& layout,
+					PointEncoding encoding);
+	// Appends a frame of faces, each of numPoints() points, a frame
+	// written again replaces the earlier one in the index
+	bool write(int frame, const std::vector<int>& ids,
+				const std::vector<const Point3*>& faces);
+	// Appends a frame of another file of the same points and encoding
+	// as it's stored, e.g. when merging the parts of a take
+	bool copy(const SequenceReader& reader, int frame);
+	// writes the index, the file is complete
+	bool close();
+	bool contains(int frame) const;
+	bool isOpen() const;
+	size_t numPoints() const { return _numPoints; }
+	PointEncoding encoding() const { return _encoding; }
+private:
+	FILE* _file = nullptr;
+	size_t _numPoints = 0;
+	PointEncoding _encoding = kFloatPoints;
+	uint64_t _end = 0;
+	std::map<int, uint64_t> _index;
+	std::vector<char> _buffer;
+	mutable std::mutex _mutex;
+
+	bool closeLocked();
+	bool appendLocked(int frame, const char* data, size_t size);
+};
+
+
+class SequenceReader {
+public:
+	SequenceReader() {}
+	~SequenceReader();
+	// false if the file is missing or isn't a sequence
+	bool open(const std::string& path);
+	void close();
+	bool isOpen() const { return _map != nullptr; }
+
+	PointEncoding encoding() const { return _encoding; }
+	int resolution() const { return _resolution; }
+	size_t numPoints() const { return _numPoints; }
+	IndexView indices() const { return _indices; }
+	IndexView kptIndices() const { return _kptIndices; }
+	IndexView triangles() const { return _triangles; }
+	IndexView lines() const { return _lines; }
+	// the above for writing another file of the same points
+	SequenceLayout layout() const;
+	// whether the writer has closed it, the frames of an unfinished file
+	// are found by a scan, e.g. of a take which is still being rendered
+	bool complete() const { return _complete; }
+	size_t fileSize() const { return _mapSize; }
+
+	std::vector<int> frames() const;
+	bool contains(int frame) const { return _index.count(frame) > 0; }
+	// -1 if the frame isn't there
+	int numFaces(int frame) const;
+	int faceId(int frame, int face) const;
+	// Decodes a face's points, all of them or the points at the given
+	// positions only, e.g. the key points of the face's points
+	bool read(int frame, int face, Point3* points) const;
+	bool read(int frame, int face, IndexView positions,
+					Point3* points) const;
+
+private:
+	SequenceReader(const SequenceReader&) = delete;
+	SequenceReader& operator=(const SequenceReader&) = delete;
+
+	void* _map = nullptr;
+	size_t _mapSize = 0;
+	PointEncoding _encoding = kFloatPoints;
+	int _resolution = 0;
+	size_t _numPoints = 0;
+	IndexView _indices;
+	IndexView _kptIndices;
+	IndexView _triangles;
+	IndexView _lines;
+	bool _complete = false;
+	std::map<int, uint64_t> _index;
+	// where the frames end, a writer continues the file there
+	uint64_t _end = 0;
+	friend class SequenceWriter;
+
+	const char* face(int frame, int face) const;
+};
+
+
+#endif // SEQUENCEFILE_H_
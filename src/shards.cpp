@@ -0,0 +1,259 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "shards.h"
+#include "sequencefile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <iostream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+std::vector<Shard> planShards(const std::string& output, int numFrames,
+					int shardFrames, int workers)
+{
+	if (shardFrames <= 0)
+		shardFrames = (numFrames + std::max(1, workers) - 1) /
+						std::max(1, workers);
+	shardFrames = std::max(1, shardFrames);
+
+	std::vector<Shard> shards;
+	for (int first = 0; first < numFrames; first += shardFrames) {
+		Shard shard;
+		shard.first = first;
+		shard.last = std::min(numFrames, first + shardFrames);
+		std::string range = std::to_string(shard.first) + "-" +
+					std::to_string(shard.last);
+		shard.path = output + "." + range + ".part";
+		shard.logPath = output + "." + range + ".log";
+		shards.push_back(shard);
+	}
+	return shards;
+}
+
+
+bool shardDone(const Shard& shard)
+{
+	SequenceReader reader;
+	if (!reader.open(shard.path) || !reader.complete())
+		return false;
+	for (int frame = shard.first; frame < shard.last; frame++) {
+		if (!reader.contains(frame))
+			return false;
+	}
+	return true;
+}
+
+
+// The worker's output goes to the shard's log, the workers' would be
+// interleaved otherwise
+static pid_t startWorker(const std::vector<std::string>& args,
+					const std::string& logPath)
+{
+	std::vector<char*> argv;
+	for (auto& arg : args)
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	argv.push_back(nullptr);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int fd = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+									0644);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		execvp(argv[0], argv.data());
+		std::perror(argv[0]);
+		_exit(127);
+	}
+	return pid;
+}
+
+
+bool runShards(const FarmConfig& config,
+			const std::vector<std::string>& images,
+			std::vector<Shard>& shards)
+{
+	int cores = std::max(1u, std::thread::hardware_concurrency());
+	int workers = std::max(1, config.workers);
+	int threads = config.threads > 0 ? config.threads :
+				std::max(1, cores / workers);
+	// the slots' cores mustn't run past the machine's and overlap
+	bool pin = config.pin && workers * threads <= cores;
+	if (config.pin && !pin)
+		std::cout << workers << " workers of " << threads
+			<< " threads don't fit " << cores
+			<< " cores apart, they aren't pinned\n";
+
+	std::deque<size_t> pending;
+	for (size_t i = 0; i < shards.size(); i++) {
+		shards[i].done = shardDone(shards[i]);
+		if (shards[i].done)
+			std::cout << "Shard " << shards[i].first << "-"
+				<< shards[i].last << " is done already\n";
+		else
+			pending.push_back(i);
+	}
+
+	// a worker keeps its slot's cores, so the running ones never share
+	struct Running
+	{
+		size_t shard;
+		int slot;
+		std::chrono::steady_clock::time_point start;
+	};
+	std::map<pid_t, Running> running;
+	std::vector<int> freeSlots;
+	for (int slot = workers - 1; slot >= 0; slot--)
+		freeSlots.push_back(slot);
+	bool ok = true;
+
+	while (!pending.empty() || !running.empty()) {
+		while (!pending.empty() && !freeSlots.empty()) {
+			Shard& shard = shards[pending.front()];
+			int slot = freeSlots.back();
+			std::string budget = std::to_string(threads);
+			if (pin)
+				budget += "@" + std::to_string(slot * threads);
+
+			std::vector<std::string> args = { config.batchPath };
+			args.insert(args.end(), config.batchArgs.begin(),
+						config.batchArgs.end());
+			args.insert(args.end(), { "-t", budget,
+				"-q", shard.path,
+				"-i", std::to_string(shard.first) });
+			args.insert(args.end(), images.begin() + shard.first,
+					images.begin() + shard.last);
+
+			pid_t pid = startWorker(args, shard.logPath);
+			if (pid < 0) {
+				std::perror("fork");
+				return false;
+			}
+			shard.attempts++;
+			running[pid] = { pending.front(), slot,
+					std::chrono::steady_clock::now() };
+			freeSlots.pop_back();
+			pending.pop_front();
+		}
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			std::perror("waitpid");
+			return false;
+		}
+		auto it = running.find(pid);
+		if (it == running.end())
+			continue;
+		Shard& shard = shards[it->second.shard];
+		std::chrono::duration<double> d =
+			std::chrono::steady_clock::now() - it->second.start;
+		shard.seconds += d.count();
+		freeSlots.push_back(it->second.slot);
+		size_t index = it->second.shard;
+		running.erase(it);
+
+		// facefit_batch exits with 2 if some frames had no face, they
+		// are in the part, 3 if a frame has failed, it isn't, a crash
+		// leaves the part unfinished
+		int code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+		shard.done = (code == 0 || code == 2) && shardDone(shard);
+		if (shard.done) {
+			std::cout << "Shard " << shard.first << "-"
+				<< shard.last << " done in " << shard.seconds
+				<< " s\n";
+		} else if (shard.attempts <= config.retries) {
+			std::cout << "Shard " << shard.first << "-"
+				<< shard.last << " failed, see "
+				<< shard.logPath << ", retrying\n";
+			pending.push_back(index);
+		} else {
+			std::cout << "Shard " << shard.first << "-"
+				<< shard.last << " failed "
+				<< shard.attempts << " times, see "
+				<< shard.logPath << "\n";
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+
+bool mergeShards(const std::vector<Shard>& shards, const std::string& output)
+{
+	std::string tmpPath = output + "." + std::to_string(getpid()) +
+								".tmp";
+	SequenceWriter writer;
+	bool opened = false;
+	bool ok = true;
+	for (const Shard& shard : shards) {
+		SequenceReader reader;
+		if (!reader.open(shard.path)) {
+			std::cout << "Couldn't read " << shard.path << "\n";
+			ok = false;
+			break;
+		}
+		if (!opened) {
+			opened = writer.open(tmpPath, reader.layout(),
+							reader.encoding());
+			if (!opened) {
+				std::cout << "Couldn't write " << tmpPath
+								<< "\n";
+				ok = false;
+				break;
+			}
+		}
+		for (int frame : reader.frames()) {
+			if (!writer.copy(reader, frame)) {
+				std::cout << shard.path << " isn't of the "
+					"points of the other parts\n";
+				ok = false;
+				break;
+			}
+		}
+		if (!ok)
+			break;
+	}
+	ok = opened && writer.close() && ok;
+
+	if (!ok || std::rename(tmpPath.c_str(), output.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+void removeShards(const std::vector<Shard>& shards)
+{
+	for (const Shard& shard : shards) {
+		std::remove(shard.path.c_str());
+		std::remove(shard.logPath.c_str());
+	}
+}
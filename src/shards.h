@@ -0,0 +1,80 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef SHARDS_H_
+#define SHARDS_H_
+
+#include <string>
+#include <vector>
+
+
+// A take split into frame ranges, each fitted by a facefit_batch process
+// of its own into a part of the sequence file, and the parts merged into
+// the take's file at the end. A part which its worker has closed with
+// every frame of the range, those without a face written without faces,
+// is done. So a failed shard or a farm run stopped half way is started
+// again without the shards finished before, and a shard started again
+// skips the frames its part has already.
+struct Shard
+{
+	// the frames [first, last), the positions of the images
+	int first = 0;
+	int last = 0;
+	// the part and the worker's output
+	std::string path;
+	std::string logPath;
+	int attempts = 0;
+	bool done = false;
+	double seconds = 0;
+};
+
+struct FarmConfig
+{
+	// the worker's executable and the options passed to every worker,
+	// e.g. the data directory, -k or -p
+	std::string batchPath = "facefit_batch";
+	std::vector<std::string> batchArgs;
+	int workers = 1;
+	// each worker's threads, pinned to cores of its own if they fit the
+	// machine's apart, 0 divides the machine's cores between the workers
+	int threads = 0;
+	bool pin = true;
+	// times a failed shard is started again
+	int retries = 2;
+};
+
+// Shards of the given size, 0 for a shard for each worker, so that each
+// worker loads the model once
+std::vector<Shard> planShards(const std::string& output, int numFrames,
+					int shardFrames, int workers);
+
+bool shardDone(const Shard& shard);
+
+// Runs the shards which aren't done, up to the workers at once, false if
+// a shard has failed more than the retries
+bool runShards(const FarmConfig& config,
+			const std::vector<std::string>& images,
+			std::vector<Shard>& shards);
+
+// Copies the parts' frames as they're stored into a single indexed file,
+// it's renamed into place once it's complete
+bool mergeShards(const std::vector<Shard>& shards, const std::string& output);
+
+// Removes the parts and the workers' logs once they're merged
+void removeShards(const std::vector<Shard>& shards);
+
+
+#endif // SHARDS_H_
@@ -0,0 +1,143 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "srgb.h"
+
+#include <cmath>
+#include <vector>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SRGB_AVX2
+#include <immintrin.h>
+#endif
+
+namespace srgb {
+
+
+unsigned char linear2srgbReference(float c)
+{
+	if (c > 0.0031308)
+		c = 1.055 * (std::pow(c, (1.0 / 2.4))) - 0.055;
+	else
+		c = 12.92 * c;
+	int v = (int)(c * 255);
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+
+static float fromBits(uint32_t bits)
+{
+	float c;
+	std::memcpy(&c, &bits, sizeof(c));
+	return c;
+}
+
+
+static std::vector<uint32_t> buildTable()
+{
+	std::vector<uint32_t> t(kOneBits >> kIndexShift);
+	for (uint32_t i = 0; i < t.size(); i++) {
+		uint32_t lo = i << kIndexShift;
+		uint32_t hi = lo | kOffsetMask;
+		unsigned char value = linear2srgbReference(fromBits(lo));
+		uint32_t offset = 0x8000;
+		if (linear2srgbReference(fromBits(hi)) != value) {
+			// the first bit pattern with the next value
+			while (lo + 1 < hi) {
+				uint32_t mid = lo + (hi - lo) / 2;
+				if (linear2srgbReference(fromBits(mid)) == value)
+					lo = mid;
+				else
+					hi = mid;
+			}
+			offset = hi & kOffsetMask;
+		}
+		t[i] = (uint32_t)value << 16 | offset;
+	}
+	return t;
+}
+
+
+const uint32_t* table()
+{
+	static const std::vector<uint32_t> t = buildTable();
+	return t.data();
+}
+
+
+#ifdef SRGB_AVX2
+// AVX has no gathers, that's AVX2. It's compiled for AVX2 regardless
+// of the build flags and chosen at runtime. Returns converted count.
+__attribute__((target("avx2")))
+static int linear2srgbRowAVX2(const uint32_t* t,
+			const float* src, std::ptrdiff_t srcStride,
+			unsigned char* dst, std::ptrdiff_t dstStride, int n)
+{
+	const __m256i offsets = _mm256_mullo_epi32(
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+		_mm256_set1_epi32((int)srcStride));
+	const __m256i one = _mm256_set1_epi32(kOneBits - 1);
+	const __m256i offsetMask = _mm256_set1_epi32(kOffsetMask);
+	const __m256i low16 = _mm256_set1_epi32(0xFFFF);
+	const __m256i white = _mm256_set1_epi32(255);
+	const __m256i zero = _mm256_setzero_si256();
+	alignas(32) int32_t out[8];
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i bits = _mm256_castps_si256(
+			_mm256_i32gather_ps(src + i * srcStride, offsets, 4));
+		__m256i negative = _mm256_cmpgt_epi32(zero, bits);
+		__m256i above = _mm256_cmpgt_epi32(bits, one);
+		__m256i index = _mm256_andnot_si256(
+			_mm256_or_si256(negative, above),
+			_mm256_srli_epi32(bits, kIndexShift));
+
+		__m256i e = _mm256_i32gather_epi32((const int*)t, index, 4);
+		__m256i rises = _mm256_cmpgt_epi32(
+			_mm256_and_si256(bits, offsetMask),
+			_mm256_sub_epi32(_mm256_and_si256(e, low16),
+					_mm256_set1_epi32(1)));
+		// the comparison gives -1 where the value rises
+		__m256i v = _mm256_sub_epi32(_mm256_srli_epi32(e, 16), rises);
+		v = _mm256_blendv_epi8(v, white, above);
+		v = _mm256_andnot_si256(negative, v);
+
+		_mm256_store_si256((__m256i*)out, v);
+		for (int k = 0; k < 8; k++)
+			dst[(i + k) * dstStride] = (unsigned char)out[k];
+	}
+	return i;
+}
+#endif
+
+
+void linear2srgbRow(const float* src, std::ptrdiff_t srcStride,
+		unsigned char* dst, std::ptrdiff_t dstStride, int n)
+{
+	const uint32_t* t = table();
+	int i = 0;
+
+#ifdef SRGB_AVX2
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	if (avx2)
+		i = linear2srgbRowAVX2(t, src, srcStride, dst, dstStride, n);
+#endif
+
+	for (; i < n; i++)
+		dst[i * dstStride] = lookup(t, src[i * srcStride]);
+}
+
+} // namespace srgb
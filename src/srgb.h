@@ -0,0 +1,68 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef SRGB_H_
+#define SRGB_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+
+// Linear float to 8 bit sRGB without calling pow() per value. The
+// result is bit-exact with linear2srgbReference(). Non-negative floats
+// are ordered like their bit patterns, the table is indexed with the
+// exponent and the top 8 bits of the mantissa. Within such a bucket the
+// curve rises less than one step, so an entry holds the bucket's value
+// and the offset of the bit pattern where it rises by one.
+namespace srgb {
+
+static const int kIndexShift = 15;
+static const uint32_t kOffsetMask = (1u << kIndexShift) - 1;
+static const uint32_t kOneBits = 0x3F800000; // 1.0f
+
+// The original per value conversion
+unsigned char linear2srgbReference(float c);
+
+// entry = value << 16 | offset, the offset is 0x8000 if the value
+// doesn't change within the bucket
+const uint32_t* table();
+
+inline unsigned char lookup(const uint32_t* t, float c)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &c, sizeof(bits));
+	if (bits >= kOneBits)
+		// negatives have the sign bit set
+		return bits & 0x80000000u ? 0 : 255;
+	uint32_t e = t[bits >> kIndexShift];
+	return (e >> 16) + ((bits & kOffsetMask) >= (e & 0xFFFF));
+}
+
+inline unsigned char linear2srgb(float c)
+{
+	return lookup(table(), c);
+}
+
+// Converts n values, strides are in elements, it's how a channel of
+// a row of an image plane is laid out
+void linear2srgbRow(const float* src, std::ptrdiff_t srcStride,
+		unsigned char* dst, std::ptrdiff_t dstStride, int n);
+
+} // namespace srgb
+
+
+#endif // SRGB_H_
@@ -0,0 +1,192 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "tfbackend.h"
+#include "trace.h"
+
+#include <tensorflow/core/framework/graph.pb.h>
+#include <tensorflow/core/protobuf/meta_graph.pb.h>
+#include <tensorflow/core/public/session_options.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace tensorflow;
+
+typedef std::vector<std::pair<std::string, Tensor>> tensor_dict;
+
+
+std::unique_ptr<InferenceBackend> TensorFlowBackend::load(
+						const ModelConfig& config)
+{
+	std::unique_ptr<TensorFlowBackend> backend(new TensorFlowBackend);
+	SessionOptions options;
+	if (config.threads > 0) {
+		// TF's intra-op pool is process-wide and sized by the first
+		// session, so it gets the whole budget. PRNet is a chain of
+		// ops, each session needs a single inter-op thread, the
+		// inter-op pool is shared too.
+		options.config.set_intra_op_parallelism_threads(config.threads);
+		options.config.set_inter_op_parallelism_threads(
+				std::max(1, config.sharedSessions));
+	}
+	Status status = NewSession(options, &backend->_sess);
+	if (!status.ok()) {
+		std::cout << "Failed to create a session: "
+				<< status.ToString() << "\n";
+		return nullptr;
+	}
+
+	// the requested variant, then the float frozen graph
+	std::vector<ModelVariant> variants;
+	if (config.variant != kMetaGraph)
+		variants.push_back(config.variant);
+	if (config.variant != kMetaGraph && config.variant != kFrozen)
+		variants.push_back(kFrozen);
+
+	for (ModelVariant v : variants) {
+		std::string path = modelVariantPath(config.checkpointPath, v);
+		if (!Env::Default()->FileExists(path).ok()) {
+			if (v != kFrozen)
+				std::cout << "No " << path << ", run "
+					<< "quantize_graph.py "
+					<< modelVariantName(v) << "\n";
+			continue;
+		}
+		status = backend->loadFrozenModel(path);
+		if (status.ok()) {
+			backend->_variant = v;
+			std::cout << "Loaded the " << modelVariantName(v)
+							<< " graph.\n";
+			return std::move(backend);
+		}
+		std::cout << "Failed to load " << path << ": "
+			<< status.ToString() << "\n";
+		// a session can't be created twice, not even after a failure
+		delete backend->_sess;
+		backend->_sess = nullptr;
+		status = NewSession(options, &backend->_sess);
+		if (!status.ok())
+			return nullptr;
+	}
+
+	status = backend->loadModel(
+		modelVariantPath(config.checkpointPath, kMetaGraph),
+		config.checkpointPath);
+	if (!status.ok()) {
+		std::cout << "Failed to load the meta graph: "
+				<< status.ToString() << "\n";
+		return nullptr;
+	}
+	backend->_variant = kMetaGraph;
+	return std::move(backend);
+}
+
+
+TensorFlowBackend::~TensorFlowBackend()
+{
+	if (_sess) {
+		_sess->Close();
+		delete _sess;
+	}
+}
+
+
+FloatTensor TensorFlowBackend::infer(const FloatTensor& input)
+{
+	TRACE_SCOPE("session run");
+	// a tensorflow::Tensor can't wrap memory it doesn't own without
+	// TF's internal API, it's a copy of about 0.8 MB per crop
+	Tensor img(DT_FLOAT, TensorShape({input.dimSize(0), input.dimSize(1),
+				input.dimSize(2), input.dimSize(3)}));
+	std::memcpy(img.flat<float>().data(), input.data(),
+					input.size() * sizeof(float));
+
+	tensor_dict feed_dict = {{kInputName, img}};
+	std::vector<Tensor> outputs;
+	Status status = _sess->Run(
+		feed_dict,
+		{kOutputName},
+		{},
+		&outputs
+	);
+	if (!status.ok()) {
+		std::cout << "Forward propagation failed: "
+				<< status.ToString() << "\n";
+		return FloatTensor();
+	}
+
+	// the result keeps the output tensor alive instead of copying it
+	auto output = std::make_shared<Tensor>(outputs.at(0));
+	if (output->dims() != 4)
+		return FloatTensor();
+	return FloatTensor(output, output->flat<float>().data(),
+		output->dim_size(0), output->dim_size(1),
+		output->dim_size(2), output->dim_size(3));
+}
+
+
+// https://github.com/PatWie/tensorflow-cmake/
+Status TensorFlowBackend::loadModel(const std::string& metaGraphPath,
+			const std::string& checkpointPath)
+{
+	Status status;
+
+	// Read in the protobuf graph we exported
+	MetaGraphDef graph_def;
+	status = ReadBinaryProto(Env::Default(), metaGraphPath, &graph_def);
+	if (status != Status::OK())
+		return status;
+
+	// create the graph in the current session
+	status = _sess->Create(graph_def.graph_def());
+	if (status != Status::OK())
+		return status;
+
+	// restore model from checkpoint, iff checkpoint is given
+	if (checkpointPath != "") {
+		const std::string restore_op_name = graph_def.saver_def().restore_op_name();
+		const std::string filename_tensor_name =
+			graph_def.saver_def().filename_tensor_name();
+
+		Tensor filename_tensor(DT_STRING, TensorShape());
+		filename_tensor.scalar<std::string>()() = checkpointPath;
+
+		tensor_dict feed_dict = {{filename_tensor_name, filename_tensor}};
+
+		status = _sess->Run(feed_dict, {}, {restore_op_name}, nullptr);
+		if (status != Status::OK())
+			return status;
+	} else {
+		status = _sess->Run({}, {}, {"init"}, nullptr);
+		if (status != Status::OK())
+			return status;
+	}
+
+	return Status::OK();
+}
+
+
+// The weights are constants in the graph, there's nothing to restore
+Status TensorFlowBackend::loadFrozenModel(const std::string& graphPath)
+{
+	GraphDef graph_def;
+	Status status = ReadBinaryProto(Env::Default(), graphPath, &graph_def);
+	if (status != Status::OK())
+		return status;
+	return _sess->Create(graph_def);
+}
@@ -0,0 +1,51 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef TFBACKEND_H_
+#define TFBACKEND_H_
+
+#include "backend.h"
+#include <tensorflow/core/public/session.h>
+
+
+// The network in a tensorflow::Session, the frozen graph of the
+// requested variant if it's there, otherwise the float frozen one and
+// then the meta graph restored from the checkpoint
+class TensorFlowBackend : public InferenceBackend {
+public:
+	static std::unique_ptr<InferenceBackend> load(
+					const ModelConfig& config);
+	~TensorFlowBackend();
+
+	FloatTensor infer(const FloatTensor& input) override;
+	ModelVariant variant() const override { return _variant; }
+	BackendType type() const override { return kTensorFlowBackend; }
+
+private:
+	TensorFlowBackend() {}
+	TensorFlowBackend(const TensorFlowBackend&) = delete;
+	TensorFlowBackend& operator=(const TensorFlowBackend&) = delete;
+
+	tensorflow::Session *_sess = nullptr;
+	ModelVariant _variant = kMetaGraph;
+
+	tensorflow::Status loadModel(const std::string& metaGraphPath,
+				const std::string& checkpointPath);
+	tensorflow::Status loadFrozenModel(const std::string& graphPath);
+};
+
+
+#endif // TFBACKEND_H_
@@ -0,0 +1,156 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "threadbudget.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+// Function statics, the budget may be set during static initialisation
+static std::mutex& budgetMutex()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+static ThreadBudget& budget()
+{
+	static ThreadBudget budget;
+	return budget;
+}
+
+static std::unique_ptr<dlib::thread_pool>& pool()
+{
+	static std::unique_ptr<dlib::thread_pool> pool;
+	return pool;
+}
+
+
+bool ThreadBudget::parse(const std::string& text)
+{
+	char* end;
+	long n = std::strtol(text.c_str(), &end, 10);
+	long core = -1;
+	if (*end == '@') {
+		const char* p = end + 1;
+		core = std::strtol(p, &end, 10);
+		if (end == p || core < 0)
+			return false;
+	}
+	if (n <= 0 || *end != '\0')
+		return false;
+	threads = n;
+	firstCore = core;
+
+	// wrapped around, the threads would share cores
+	int cores = std::max(1u, std::thread::hardware_concurrency());
+	if (!clamp(cores))
+		std::cout << "Only " << cores << " cores, the thread budget "
+			<< text << " is " << str() << " instead\n";
+	return true;
+}
+
+
+bool ThreadBudget::clamp(int cores)
+{
+	if (threads <= 0 || firstCore < 0)
+		return true;
+	if (firstCore >= cores) {
+		firstCore = -1;
+		return false;
+	}
+	if (firstCore + threads > cores) {
+		threads = cores - firstCore;
+		return false;
+	}
+	return true;
+}
+
+
+std::string ThreadBudget::str() const
+{
+	if (threads <= 0)
+		return "default";
+	std::string s = std::to_string(threads);
+	if (firstCore >= 0)
+		s += "@" + std::to_string(firstCore);
+	return s;
+}
+
+
+void setThreadBudget(const ThreadBudget& b)
+{
+	std::lock_guard<std::mutex> lock(budgetMutex());
+	budget() = b;
+	// made again of the new budget on the next use
+	pool().reset();
+}
+
+
+ThreadBudget threadBudget()
+{
+	std::lock_guard<std::mutex> lock(budgetMutex());
+	return budget();
+}
+
+
+dlib::thread_pool& hostThreadPool()
+{
+	std::lock_guard<std::mutex> lock(budgetMutex());
+	const ThreadBudget& b = budget();
+	if (b.threads <= 0)
+		return dlib::default_thread_pool();
+	if (!pool()) {
+		// the workers are started by a pinned thread, so they
+		// inherit its cores. A pool of none runs the tasks on the
+		// calling thread, with a single thread there's no handoff.
+		std::thread([&] {
+			pinThread(b);
+			pool().reset(new dlib::thread_pool(
+					b.threads > 1 ? b.threads : 0));
+		}).join();
+	}
+	return *pool();
+}
+
+
+bool pinThread(const ThreadBudget& b)
+{
+	if (b.threads <= 0 || b.firstCore < 0)
+		return true;
+#ifdef __linux__
+	ThreadBudget clamped = b;
+	clamped.clamp(std::max(1u, std::thread::hardware_concurrency()));
+	if (clamped.firstCore < 0)
+		return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int i = 0; i < clamped.threads; i++)
+		CPU_SET(clamped.firstCore + i, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,60 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef THREADBUDGET_H_
+#define THREADBUDGET_H_
+
+#include <dlib/threads.h>
+#include <string>
+
+
+// How many cores FaceFit may use in a process. The sessions of the
+// inference backend and the host's stages, the conversions running on
+// dlib's parallel_for, share them. Without a budget every runtime sizes
+// its pools to all the cores, on top of Nuke's own threads.
+struct ThreadBudget
+{
+	// 0 leaves each runtime its own default
+	int threads = 0;
+	// the threads are pinned to the cores from this one on,
+	// -1 leaves them to the scheduler
+	int firstCore = -1;
+
+	// "8" for eight threads, "8@16" for eight pinned to the cores 16-23,
+	// a range past the machine's cores is clamped with a warning
+	bool parse(const std::string& text);
+	std::string str() const;
+	// Keeps the pinned cores within the machine's, the threads from a
+	// core past them aren't pinned, false if it's changed anything
+	bool clamp(int cores);
+};
+
+// Takes effect for the sessions loaded and the host's pool used after
+// it, i.e. it's set before the first frame. It mustn't be called while
+// something runs on the host's pool.
+void setThreadBudget(const ThreadBudget& budget);
+ThreadBudget threadBudget();
+
+// The pool the host's parallel_for runs on, of the budget's size, or
+// dlib's default one of all the cores without a budget
+dlib::thread_pool& hostThreadPool();
+
+// Restricts the calling thread to the budget's cores, the threads it
+// starts from then on inherit them. False if it's failed.
+bool pinThread(const ThreadBudget& budget);
+
+
+#endif // THREADBUDGET_H_
@@ -0,0 +1,194 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+namespace trace {
+
+static const char* kTraceEnv = "FACEFIT_TRACE";
+
+static const char* kCounterNames[kNumCounters] = {
+	"inferences",
+	"failed inferences",
+	"cache hits",
+	"cache misses",
+	"detector misses",
+	"detector skips",
+	"track losses",
+	"interpolated frames",
+	"look-ahead fitted",
+	"look-ahead cancelled",
+	"bytes fetched",
+	"points copied",
+};
+
+struct Event
+{
+	const char* name;
+	int64_t ts;
+	int64_t dur; // the value for counter events
+	bool counter;
+};
+
+// Every thread appends into its own buffer, the buffers are owned by
+// the registry so events outlive threads which have finished
+struct ThreadBuffer
+{
+	std::mutex mutex;
+	std::vector<Event> events;
+	int tid;
+};
+
+struct Registry
+{
+	std::mutex mutex;
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+	~Registry() { flush(); }
+};
+
+
+static const char* tracePath()
+{
+	const char* path = std::getenv(kTraceEnv);
+	return path && *path ? path : nullptr;
+}
+
+const bool enabled = tracePath() != nullptr;
+std::atomic<int64_t> counters[kNumCounters];
+
+
+// function-local so scopes in static initialisers of other
+// translation units see an initialised value
+static std::chrono::steady_clock::time_point startTime()
+{
+	static const auto start = std::chrono::steady_clock::now();
+	return start;
+}
+
+
+static Registry& registry()
+{
+	static Registry r;
+	return r;
+}
+
+
+static ThreadBuffer& threadBuffer()
+{
+	thread_local std::shared_ptr<ThreadBuffer> buffer;
+	if (!buffer) {
+		buffer = std::make_shared<ThreadBuffer>();
+		Registry& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		buffer->tid = (int)r.buffers.size();
+		r.buffers.push_back(buffer);
+	}
+	return *buffer;
+}
+
+
+int64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - startTime()).count();
+}
+
+
+void complete(const char* name, int64_t start, int64_t end)
+{
+	ThreadBuffer& buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	buffer.events.push_back({ name, start, end - start, false });
+}
+
+
+void countEvent(Counter counter, int64_t value)
+{
+	ThreadBuffer& buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	buffer.events.push_back({ kCounterNames[counter], now(), value, true });
+}
+
+
+size_t residentBytes()
+{
+	FILE* f = std::fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+	unsigned long size = 0, resident = 0;
+	if (std::fscanf(f, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	std::fclose(f);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+bool flush()
+{
+	const char* path = tracePath();
+	if (!enabled || !path)
+		return false;
+
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+
+	FILE* f = std::fopen(path, "w");
+	if (!f)
+		return false;
+
+	int pid = getpid();
+	bool first = true;
+	std::fprintf(f, "{\"traceEvents\": [");
+	for (auto& buffer : r.buffers) {
+		std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+		for (const Event& e : buffer->events) {
+			std::fprintf(f, "%s\n", first ? "" : ",");
+			first = false;
+			if (e.counter) {
+				std::fprintf(f, "{\"name\": \"%s\", \"ph\": \"C\", "
+					"\"ts\": %lld, \"pid\": %d, "
+					"\"args\": {\"value\": %lld}}",
+					e.name, (long long)e.ts, pid,
+					(long long)e.dur);
+			} else {
+				std::fprintf(f, "{\"name\": \"%s\", \"ph\": \"X\", "
+					"\"ts\": %lld, \"dur\": %lld, "
+					"\"pid\": %d, \"tid\": %d}",
+					e.name, (long long)e.ts,
+					(long long)e.dur, pid, buffer->tid);
+			}
+		}
+	}
+	std::fprintf(f, "\n]}\n");
+
+	std::printf("Trace written to %s:", path);
+	for (int i = 0; i < kNumCounters; i++)
+		std::printf(" %s %lld%s", kCounterNames[i],
+			(long long)counterValue((Counter)i),
+			i + 1 < kNumCounters ? "," : "\n");
+	return std::fclose(f) == 0;
+}
+
+} // namespace trace
@@ -0,0 +1,97 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+// A lightweight instrumentation of the pipeline. If FACEFIT_TRACE is set
+// to a file path, scoped timers and counters are recorded and written
+// there at exit in the Chrome trace format, which chrome://tracing and
+// Perfetto open. Otherwise a scope costs a check of a static flag.
+namespace trace {
+
+enum Counter {
+	kInferences,
+	kFailedInferences,	// no session or the session has failed
+	kCacheHits,
+	kCacheMisses,
+	kDetectorMisses,
+	kDetectorSkips,
+	kTrackLosses,
+	kInterpolatedFrames,
+	kLookAheadFitted,
+	kLookAheadCancelled,
+	kBytesFetched,
+	kPointsCopied,	// between the plug-in's buffers and the geometry
+	kNumCounters
+};
+
+extern const bool enabled;
+
+int64_t now(); // microseconds since the start of the process
+void complete(const char* name, int64_t start, int64_t end);
+void countEvent(Counter counter, int64_t value);
+// Writes everything recorded so far, it's also called at exit
+bool flush();
+// Resident memory of the process in bytes, 0 if it's unknown
+size_t residentBytes();
+
+extern std::atomic<int64_t> counters[kNumCounters];
+
+inline void count(Counter counter, int64_t n = 1)
+{
+	int64_t value = counters[counter].fetch_add(n,
+				std::memory_order_relaxed) + n;
+	if (enabled)
+		countEvent(counter, value);
+}
+
+inline int64_t counterValue(Counter counter)
+{
+	return counters[counter].load(std::memory_order_relaxed);
+}
+
+// Records the lifetime of the object as an event, name should be a literal
+class Scope {
+public:
+	Scope(const char* name) : _name(name), _start(enabled ? now() : 0) {}
+	~Scope()
+	{
+		if (enabled)
+			complete(_name, _start, now());
+	}
+private:
+	Scope(const Scope&) = delete;
+	Scope& operator=(const Scope&) = delete;
+	const char* _name;
+	int64_t _start;
+};
+
+} // namespace trace
+
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+	trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+
+#endif // TRACE_H_
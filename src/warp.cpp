@@ -0,0 +1,166 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#include "warp.h"
+#include "srgb.h"
+
+#include <algorithm>
+#include <cmath>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WARP_AVX2
+#include <immintrin.h>
+#endif
+
+// the crop's width the row buffers are sized for
+static const int kMaxWidth = 1024;
+
+
+// Bilinear sample, taps outside the view count as black
+static inline void sample(const ImageView& plane, float px, float py,
+								float* rgb)
+{
+	float fx = std::floor(px), fy = std::floor(py);
+	int x0 = (int)fx, y0 = (int)fy;
+	float ax = px - fx, ay = py - fy;
+	rgb[0] = rgb[1] = rgb[2] = 0;
+
+	if (x0 >= 0 && y0 >= 0 && x0 + 1 < plane.width &&
+					y0 + 1 < plane.height) {
+		const float* p = plane.row(y0) + x0 * plane.colStride;
+		for (int c = 0; c < 3; c++) {
+			const float* q = p + c * plane.chanStride;
+			float top = q[0] + ax * (q[plane.colStride] - q[0]);
+			const float* r = q + plane.rowStride;
+			float bottom = r[0] + ax * (r[plane.colStride] - r[0]);
+			rgb[c] = top + ay * (bottom - top);
+		}
+		return;
+	}
+
+	float w[4] = {
+		(1 - ax) * (1 - ay), ax * (1 - ay),
+		(1 - ax) * ay, ax * ay
+	};
+	for (int k = 0; k < 4; k++) {
+		int x = x0 + (k & 1), y = y0 + (k >> 1);
+		if (x < 0 || y < 0 || x >= plane.width || y >= plane.height)
+			continue;
+		for (int c = 0; c < 3; c++)
+			rgb[c] += w[k] * plane.at(x, y, c);
+	}
+}
+
+
+#ifdef WARP_AVX2
+// Eight samples at a time while all four taps of each are inside
+// the view, returns how many pixels of the row it has done
+__attribute__((target("avx2")))
+static int sampleRowAVX2(const ImageView& plane, float px0, float py0,
+			float dx, float dy, int width, float* linear)
+{
+	const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i maxX = _mm256_set1_epi32(plane.width - 2);
+	const __m256i maxY = _mm256_set1_epi32(plane.height - 2);
+	const __m256i rowStride = _mm256_set1_epi32((int)plane.rowStride);
+	const __m256i colStride = _mm256_set1_epi32((int)plane.colStride);
+	alignas(32) float out[3][8];
+
+	int x = 0;
+	for (; x + 8 <= width; x += 8) {
+		__m256 xs = _mm256_add_ps(_mm256_set1_ps((float)x), lane);
+		__m256 px = _mm256_add_ps(_mm256_set1_ps(px0),
+				_mm256_mul_ps(_mm256_set1_ps(dx), xs));
+		__m256 py = _mm256_add_ps(_mm256_set1_ps(py0),
+				_mm256_mul_ps(_mm256_set1_ps(dy), xs));
+		__m256 fx = _mm256_floor_ps(px);
+		__m256 fy = _mm256_floor_ps(py);
+		__m256i ix = _mm256_cvttps_epi32(fx);
+		__m256i iy = _mm256_cvttps_epi32(fy);
+
+		__m256i outside = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi32(zero, ix),
+					_mm256_cmpgt_epi32(ix, maxX)),
+			_mm256_or_si256(_mm256_cmpgt_epi32(zero, iy),
+					_mm256_cmpgt_epi32(iy, maxY)));
+		if (!_mm256_testz_si256(outside, outside)) {
+			// an edge, these go through the scalar path
+			for (int k = 0; k < 8; k++)
+				sample(plane, px0 + dx * (x + k),
+					py0 + dy * (x + k),
+					linear + (x + k) * 3);
+			continue;
+		}
+
+		__m256 ax = _mm256_sub_ps(px, fx);
+		__m256 ay = _mm256_sub_ps(py, fy);
+		__m256i offset = _mm256_add_epi32(
+			_mm256_mullo_epi32(iy, rowStride),
+			_mm256_mullo_epi32(ix, colStride));
+
+		for (int c = 0; c < 3; c++) {
+			const float* q = plane.data + c * plane.chanStride;
+			const float* r = q + plane.rowStride;
+			__m256 p00 = _mm256_i32gather_ps(q, offset, 4);
+			__m256 p10 = _mm256_i32gather_ps(
+					q + plane.colStride, offset, 4);
+			__m256 p01 = _mm256_i32gather_ps(r, offset, 4);
+			__m256 p11 = _mm256_i32gather_ps(
+					r + plane.colStride, offset, 4);
+			__m256 top = _mm256_add_ps(p00, _mm256_mul_ps(ax,
+						_mm256_sub_ps(p10, p00)));
+			__m256 bottom = _mm256_add_ps(p01, _mm256_mul_ps(ax,
+						_mm256_sub_ps(p11, p01)));
+			_mm256_store_ps(out[c], _mm256_add_ps(top,
+				_mm256_mul_ps(ay, _mm256_sub_ps(bottom, top))));
+		}
+		for (int k = 0; k < 8; k++) {
+			float* rgb = linear + (x + k) * 3;
+			rgb[0] = out[0][k];
+			rgb[1] = out[1][k];
+			rgb[2] = out[2][k];
+		}
+	}
+	return x;
+}
+#endif
+
+
+void warpRow(const ImageView& plane, const CropMap& map, int y, int width,
+								float* dst)
+{
+	float linear[kMaxWidth * 3];
+	unsigned char srgb[kMaxWidth * 3];
+	width = std::min(width, kMaxWidth);
+
+	// positions along a row are incremental
+	float px0 = map.m01 * y + map.b0;
+	float py0 = map.m11 * y + map.b1;
+	float dx = map.m00, dy = map.m10;
+
+	int x = 0;
+#ifdef WARP_AVX2
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	if (avx2)
+		x = sampleRowAVX2(plane, px0, py0, dx, dy, width, linear);
+#endif
+	for (; x < width; x++)
+		sample(plane, px0 + dx * x, py0 + dy * x, linear + x * 3);
+
+	srgb::linear2srgbRow(linear, 1, srgb, 1, width * 3);
+	for (int i = 0; i < width * 3; i++)
+		dst[i] = srgb[i] * (1.0f / 255.0f);
+}
@@ -0,0 +1,40 @@
+/* ************************************************************************
+ * Copyright 2019 Alexander Mishurov
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+#ifndef WARP_H_
+#define WARP_H_
+
+#include "imageview.h"
+
+
+// An affine map from the pixels of a crop into the pixels of a view,
+// x' = m00 * x + m01 * y + b0, y' = m10 * x + m11 * y + b1
+struct CropMap
+{
+	double m00, m01, m10, m11;
+	double b0, b1;
+};
+
+// Fills a row of the network's input in a single pass: samples the view
+// bilinearly through the map, applies the sRGB curve (8 bit, as the net
+// was trained on) and writes interleaved RGB floats in [0, 1]. Samples
+// outside the view are black. The interior is sampled with AVX2
+// gathers if the CPU has them.
+void warpRow(const ImageView& plane, const CropMap& map, int y, int width,
+								float* dst);
+
+
+#endif // WARP_H_